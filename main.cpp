@@ -2,24 +2,400 @@
 #include <vector>
 #include <string>
 #include <stack>
+#include <thread>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <map>
+#include <limits>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <deque>
+#include <fstream>
+#include <filesystem>
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// USDT tracepoints under the provider "todo". With <sys/sdt.h> each probe compiles to a single
+// nop until a tracer attaches; without it the probes and their arguments compile to nothing.
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TODO_HAS_USDT 1
+#endif
+#endif
+#if defined(TODO_HAS_USDT)
+#define TODO_PROBE2(name, a, b) DTRACE_PROBE2(todo, name, a, b)
+#define TODO_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(todo, name, a, b, c, d, e)
+#else
+#define TODO_PROBE2(name, a, b) ((void)0)
+#define TODO_PROBE5(name, a, b, c, d, e) ((void)0)
+#endif
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+string toLowerAscii(const string& text) {
+    string lowered(text);
+    for (char& c : lowered) {
+        if (c >= 'A' && c <= 'Z') {
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+    return lowered;
+}
+
+// Heap bytes owned by a string; none while it fits in the small-string buffer.
+size_t stringHeapBytes(const string& text) {
+    static const size_t inlineCapacity = string().capacity();
+    return text.capacity() > inlineCapacity ? text.capacity() + 1 : 0;
+}
+
+size_t stringsHeapBytes(const vector<string>& texts) {
+    size_t bytes = texts.capacity() * sizeof(string);
+    for (const string& text : texts) {
+        bytes += stringHeapBytes(text);
+    }
+    return bytes;
+}
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar.
+long long daysFromCivil(long long year, unsigned month, unsigned day) {
+    year -= month <= 2 ? 1 : 0;
+    const long long era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    const unsigned dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<long long>(dayOfEra) - 719468;
+}
+
+string civilFromDays(long long days) {
+    days += 719468;
+    const long long era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned monthIndex = (5 * dayOfYear + 2) / 153;
+    const unsigned day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    const unsigned month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    const long long year = static_cast<long long>(yearOfEra) + era * 400 + (month <= 2 ? 1 : 0);
+
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%04lld-%02u-%02u", year, month, day);
+    return buffer;
+}
+
+// Parses YYYY-MM-DD into days since the epoch.
+bool parseDate(const string& text, long long& days) {
+    int year, month, day;
+    char dash1, dash2;
+    if (sscanf(text.c_str(), "%d%c%d%c%d", &year, &dash1, &month, &dash2, &day) != 5 || dash1 != '-' || dash2 != '-' ||
+        month < 1 || month > 12 || day < 1 || day > 31) {
+        return false;
+    }
+    days = daysFromCivil(year, static_cast<unsigned>(month), static_cast<unsigned>(day));
+    return true;
+}
+
+long long currentTimestamp() {
+    return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+long long currentTimeMillis() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// A note or file attached to a task. Only this reference lives with the task; the content is
+// kept in the BlobStore under blobId.
+struct Attachment {
+    string name;
+    string blobId;
+    uint64_t size = 0;
+    bool isNote = false;
+};
+
+size_t attachmentsHeapBytes(const vector<Attachment>& attachments) {
+    size_t bytes = attachments.capacity() * sizeof(Attachment);
+    for (const Attachment& attachment : attachments) {
+        bytes += stringHeapBytes(attachment.name) + stringHeapBytes(attachment.blobId);
+    }
+    return bytes;
+}
+
+// A snapshot of one task taken before a change, used to undo or redo that change. A memento
+// with present == false records that the task did not exist (undoing an add deletes it again);
+// position is the slot the task occupied, so a deleted task returns to where it was.
 class TaskMemento {
 public:
-    TaskMemento(const string& desc, bool completed, const string& dueDate)
-        : description(desc), isCompleted(completed), dueDate(dueDate) {}
+    TaskMemento(long long taskId, const string& desc, bool completed, const string& dueDate, const vector<string>& tags,
+                long long createdAt, long long completedAt, long long parentId = 0)
+        : taskId(taskId), present(true), position(0), recordedAt(0), chained(false), description(desc), isCompleted(completed),
+          dueDate(dueDate), tags(tags), createdAt(createdAt), completedAt(completedAt), parentId(parentId) {}
+
+    static TaskMemento absent(long long taskId, size_t position) {
+        TaskMemento memento(taskId, "", false, "", vector<string>(), 0, 0);
+        memento.present = false;
+        memento.position = position;
+        return memento;
+    }
 
+    long long getTaskId() const { return taskId; }
+    bool isPresent() const { return present; }
+    size_t getPosition() const { return position; }
+    void setPosition(size_t slot) { position = slot; }
+    long long getRecordedAt() const { return recordedAt; }
+    void setRecordedAt(long long millis) { recordedAt = millis; }
+    bool isChained() const { return chained; }
+    void setChained(bool withEntryBelow) { chained = withEntryBelow; }
     const string& getDescription() const { return description; }
     bool getCompletedStatus() const { return isCompleted; }
     const string& getDueDate() const { return dueDate; }
+    const vector<string>& getTags() const { return tags; }
+    long long getCreatedAt() const { return createdAt; }
+    long long getCompletedAt() const { return completedAt; }
+    long long getParentId() const { return parentId; }
+    const vector<Attachment>& getAttachments() const { return attachments; }
+    void setAttachments(const vector<Attachment>& refs) { attachments = refs; }
+
+    // Bytes the memento occupies, including what its strings and vectors own on the heap.
+    size_t footprint() const {
+        return sizeof(TaskMemento) + stringHeapBytes(description) + stringHeapBytes(dueDate) + stringsHeapBytes(tags) +
+               attachmentsHeapBytes(attachments);
+    }
 
 private:
+    long long taskId;
+    bool present;
+    size_t position;
+    long long recordedAt; // Milliseconds; for coalesced entries, the time of the latest change
+    bool chained;         // Undone and redone together with the entry below it on the stack
     string description;
     bool isCompleted;
     string dueDate;
+    vector<string> tags;
+    long long createdAt;
+    long long completedAt;
+    long long parentId;
+    vector<Attachment> attachments;
+};
+
+// Version of the saved-state encoding written by BinaryWriter. Each version only added fields, so
+// BinaryReader can still read everything back to version 1.
+const int stateFormatVersion = 7;
+
+// Compact binary encoding used for saved state: LEB128 varints, zigzag for signed values and
+// length-prefixed strings.
+class BinaryWriter {
+public:
+    void writeUnsigned(uint64_t value) {
+        while (value >= 0x80) {
+            buffer += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        buffer += static_cast<char>(value);
+    }
+
+    void writeSigned(long long value) {
+        writeUnsigned((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void writeString(const string& text) {
+        writeUnsigned(text.size());
+        buffer += text;
+    }
+
+    void writeMemento(const TaskMemento& memento) {
+        writeSigned(memento.getTaskId());
+        writeUnsigned(memento.isPresent() ? 1 : 0);
+        writeUnsigned(memento.getPosition());
+        writeSigned(memento.getRecordedAt());
+        writeUnsigned(memento.isChained() ? 1 : 0);
+        if (!memento.isPresent()) {
+            return;
+        }
+        writeString(memento.getDescription());
+        writeUnsigned(memento.getCompletedStatus() ? 1 : 0);
+        writeString(memento.getDueDate());
+        writeUnsigned(memento.getTags().size());
+        for (const string& tag : memento.getTags()) {
+            writeString(tag);
+        }
+        writeSigned(memento.getCreatedAt());
+        writeSigned(memento.getCompletedAt());
+        writeSigned(memento.getParentId());
+        writeUnsigned(memento.getAttachments().size());
+        for (const Attachment& attachment : memento.getAttachments()) {
+            writeString(attachment.name);
+            writeString(attachment.blobId);
+            writeUnsigned(attachment.size);
+            writeUnsigned(attachment.isNote ? 1 : 0);
+        }
+    }
+
+    const string& data() const {
+        return buffer;
+    }
+
+private:
+    string buffer;
+};
+
+class BinaryReader {
+public:
+    BinaryReader(const char* data, size_t size, int formatVersion = stateFormatVersion)
+        : cursor(data), end(data + size), version(formatVersion) {}
+
+    bool readUnsigned(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (cursor == end) {
+                return false;
+            }
+            unsigned char byte = static_cast<unsigned char>(*cursor++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool readSigned(long long& value) {
+        uint64_t encoded;
+        if (!readUnsigned(encoded)) {
+            return false;
+        }
+        value = static_cast<long long>((encoded >> 1) ^ (~(encoded & 1) + 1));
+        return true;
+    }
+
+    bool readString(string& text) {
+        uint64_t length;
+        if (!readUnsigned(length) || length > static_cast<uint64_t>(end - cursor)) {
+            return false;
+        }
+        text.assign(cursor, static_cast<size_t>(length));
+        cursor += length;
+        return true;
+    }
+
+    // Fields added after version 1 keep their defaults when reading an older version.
+    bool readMemento(unique_ptr<TaskMemento>& memento) {
+        long long taskId, recordedAt = 0, createdAt, completedAt, parentId = 0;
+        uint64_t present, position, chained = 0, completed, tagCount;
+        if (!readSigned(taskId) || !readUnsigned(present) || !readUnsigned(position) ||
+            (version >= 2 && !readSigned(recordedAt)) || (version >= 3 && !readUnsigned(chained))) {
+            return false;
+        }
+        if (present == 0) {
+            memento.reset(new TaskMemento(TaskMemento::absent(taskId, position)));
+            memento->setRecordedAt(recordedAt);
+            memento->setChained(chained != 0);
+            return true;
+        }
+        string description, dueDate;
+        if (!readString(description) || !readUnsigned(completed) || !readString(dueDate) || !readUnsigned(tagCount)) {
+            return false;
+        }
+        vector<string> tags;
+        for (uint64_t i = 0; i < tagCount; ++i) {
+            string tag;
+            if (!readString(tag)) {
+                return false;
+            }
+            tags.push_back(tag);
+        }
+        uint64_t attachmentCount = 0;
+        if (!readSigned(createdAt) || !readSigned(completedAt) || (version >= 3 && !readSigned(parentId)) ||
+            (version >= 4 && !readUnsigned(attachmentCount))) {
+            return false;
+        }
+        vector<Attachment> attachments;
+        for (uint64_t i = 0; i < attachmentCount; ++i) {
+            Attachment attachment;
+            uint64_t isNote;
+            if (!readString(attachment.name) || !readString(attachment.blobId) || !readUnsigned(attachment.size) ||
+                !readUnsigned(isNote)) {
+                return false;
+            }
+            attachment.isNote = isNote != 0;
+            attachments.push_back(attachment);
+        }
+        memento.reset(new TaskMemento(taskId, description, completed != 0, dueDate, tags, createdAt, completedAt, parentId));
+        memento->setAttachments(attachments);
+        memento->setPosition(position);
+        memento->setRecordedAt(recordedAt);
+        memento->setChained(chained != 0);
+        return true;
+    }
+
+    bool atEnd() const {
+        return cursor == end;
+    }
+
+    void setFormatVersion(int formatVersion) {
+        version = formatVersion;
+    }
+
+private:
+    const char* cursor;
+    const char* end;
+    int version;
 };
 
+bool readFile(const string& path, string& contents) {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        return false;
+    }
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return true;
+}
+
+// Writes to a temporary file first so a crash never leaves a half-written file behind.
+bool writeFileAtomically(const string& path, const string& contents) {
+    string temporary = path + ".tmp";
+    {
+        ofstream out(temporary, ios::binary | ios::trunc);
+        if (!out.write(contents.data(), contents.size())) {
+            return false;
+        }
+    }
+    return rename(temporary.c_str(), path.c_str()) == 0;
+}
+
 class Task {
 public:
     class Builder {
@@ -36,8 +412,15 @@ public:
             return *this;
         }
 
+        Builder& setParent(long long parentTaskId) {
+            parentId = parentTaskId;
+            return *this;
+        }
+
         Task build() const {
-            return Task(description, completed, dueDate, tags);
+            Task task(description, completed, dueDate, tags, currentTimestamp());
+            task.parentId = parentId;
+            return task;
         }
 
     private:
@@ -45,22 +428,49 @@ public:
         bool completed;
         string dueDate;
         vector<string> tags;
+        long long parentId = 0;
 
         friend class Task;
     };
 
-    void markCompleted() {
+    void markCompleted(long long timestamp = currentTimestamp()) {
         if (!completed) {
             completed = true;
+            completedAt = timestamp;
         }
     }
 
     void markPending() {
         if (completed) {
             completed = false;
+            completedAt = 0;
         }
     }
 
+    long long getId() const {
+        return id;
+    }
+
+    void assignId(long long taskId) {
+        id = taskId;
+    }
+
+    long long getParentId() const {
+        return parentId;
+    }
+
+    void assignParent(long long parentTaskId) {
+        parentId = parentTaskId;
+    }
+
+    long long getCreatedAt() const {
+        return createdAt;
+    }
+
+    long long getCompletedAt() const {
+        return completedAt;
+    }
+
     bool isCompleted() const {
         return completed;
     }
@@ -69,49 +479,165 @@ public:
         return description;
     }
 
-    void display(int index) const {
-        cout << index + 1 << ". " << description << " - " << (completed ? "Completed" : "Pending");
+    const string& getLowerDescription() const {
+        return lowerDescription;
+    }
+
+    const string& getDueDate() const {
+        return dueDate;
+    }
+
+    const vector<string>& getTags() const {
+        return tags;
+    }
+
+    const vector<Attachment>& getAttachments() const {
+        return attachments;
+    }
+
+    void addAttachment(const Attachment& attachment) {
+        attachments.push_back(attachment);
+    }
+
+    string summary(int index) const {
+        string line = to_string(index + 1) + ". " + description + " - " + (completed ? "Completed" : "Pending");
         if (!dueDate.empty()) {
-            cout << ", Due: " << dueDate;
+            line += ", Due: " + dueDate;
         }
-        cout << endl;
+        if (!tags.empty()) {
+            line += ", Tags: ";
+            for (size_t i = 0; i < tags.size(); ++i) {
+                line += (i > 0 ? ", " : "") + tags[i];
+            }
+        }
+        if (!attachments.empty()) {
+            line += ", Attachments: " + to_string(attachments.size());
+        }
+        return line;
+    }
+
+    void display(int index) const {
+        cout << summary(index) << endl;
+    }
+
+    // Bytes owned on the heap by the task's strings and vectors, not counting the record itself.
+    size_t heapBytes() const {
+        return stringHeapBytes(description) + stringHeapBytes(lowerDescription) + stringHeapBytes(dueDate) +
+               stringsHeapBytes(tags) + attachmentsHeapBytes(attachments);
     }
 
     TaskMemento save() const {
-        return TaskMemento(description, completed, dueDate);
+        TaskMemento memento(id, description, completed, dueDate, tags, createdAt, completedAt, parentId);
+        memento.setAttachments(attachments);
+        return memento;
     }
 
     void restore(const TaskMemento& memento) {
         description = memento.getDescription();
+        lowerDescription = toLowerAscii(description);
         completed = memento.getCompletedStatus();
         dueDate = memento.getDueDate();
+        tags = memento.getTags();
+        createdAt = memento.getCreatedAt();
+        completedAt = memento.getCompletedAt();
+        attachments = memento.getAttachments();
+    }
+
+    static Task fromMemento(const TaskMemento& memento) {
+        Task task(memento.getDescription(), memento.getCompletedStatus(), memento.getDueDate(), memento.getTags(),
+                  memento.getCreatedAt());
+        task.id = memento.getTaskId();
+        task.completedAt = memento.getCompletedAt();
+        task.parentId = memento.getParentId();
+        task.attachments = memento.getAttachments();
+        return task;
     }
 
 private:
-    Task(const string& desc, bool isCompleted, const string& date, const vector<string>& taskTags)
-        : description(desc), completed(isCompleted), dueDate(date), tags(taskTags) {}
+    Task(const string& desc, bool isCompleted, const string& date, const vector<string>& taskTags, long long created)
+        : description(desc), lowerDescription(toLowerAscii(desc)), completed(isCompleted), dueDate(date), tags(taskTags),
+          createdAt(created) {}
+
+    long long id = 0;
+    long long parentId = 0; // 0 for top-level tasks
 
     string description;
+    string lowerDescription; // ASCII-folded shadow of description used by substring search
     bool completed;
     string dueDate;
     vector<string> tags;
+    long long createdAt;
+    long long completedAt = 0;
+    vector<Attachment> attachments;
 };
 
+// Undo and redo stacks. The undo stack can be backed by a history file of records laid out as
+// [payload][4-byte payload length], so it can be read from the end backwards: on startup nothing
+// is read, and older entries are loaded in batches only when undo reaches them. Entries that are
+// still unloaded occupy the first part of the file, up to unloadedEnd.
 class TaskHistory {
 public:
-    void addMemento(const TaskMemento& memento) {
-        history.push(memento);
-        redoStack = stack<TaskMemento>(); // Clear redo stack when a new action is performed
+    // Consecutive changes to the same task within the coalescing window become one undo step:
+    // the entry already on top keeps the state from before the first change, so undoing it
+    // reverts the whole run. Runs never extend across an undo, so redo history stays exact.
+    void addMemento(const TaskMemento& memento, bool chained = false) {
+        long long now = currentTimeMillis();
+        if (!chained && coalesceWindowMillis > 0 && !coalesceBarrier && redoStack.empty() && !history.empty() &&
+            history.back().getTaskId() == memento.getTaskId() &&
+            now - history.back().getRecordedAt() <= coalesceWindowMillis) {
+            if (savedLengths.size() == history.size()) {
+                savedLengths.pop_back(); // The top entry no longer matches its record
+            }
+            history.back().setRecordedAt(now);
+            ++coalescedEntries;
+            return;
+        }
+        history.push_back(memento);
+        history.back().setRecordedAt(now);
+        history.back().setChained(chained);
+        undoBytes += history.back().footprint();
+        coalesceBarrier = chained;
+        redoStack.clear(); // Clear redo stack when a new action is performed
+        redoBytes = 0;
+    }
+
+    // Keeps the next change from being merged into the current top entry.
+    void breakCoalescing() {
+        coalesceBarrier = true;
+    }
+
+    void setCoalesceWindow(long long millis) {
+        coalesceWindowMillis = millis;
+    }
+
+    size_t getCoalescedCount() const {
+        return coalescedEntries;
+    }
+
+    void addUndoMemento(const TaskMemento& memento) {
+        history.push_back(memento);
+        undoBytes += history.back().footprint();
+    }
+
+    void addRedoMemento(const TaskMemento& memento) {
+        redoStack.push_back(memento);
+        redoBytes += redoStack.back().footprint();
     }
 
     TaskMemento getMemento() {
-        TaskMemento memento = history.top();
-        history.pop();
-        redoStack.push(memento);
+        TaskMemento memento = history.back();
+        undoBytes -= history.back().footprint();
+        history.pop_back();
+        if (savedLengths.size() > history.size()) {
+            savedLengths.pop_back();
+        }
         return memento;
     }
 
-    bool isEmpty() const {
+    bool isEmpty() {
+        if (history.empty() && unloadedCount > 0) {
+            loadOlder();
+        }
         return history.empty();
     }
 
@@ -120,183 +646,6216 @@ public:
     }
 
     TaskMemento redo() {
-        TaskMemento memento = redoStack.top();
-        redoStack.pop();
-        history.push(memento);
+        TaskMemento memento = redoStack.back();
+        redoBytes -= redoStack.back().footprint();
+        redoStack.pop_back();
         return memento;
     }
 
-private:
-    stack<TaskMemento> history;
-    stack<TaskMemento> redoStack;
-};
+    size_t depth() const {
+        return history.size() + unloadedCount;
+    }
 
-class ToDoListManager {
-public:
-    void addTask(const Task& task) {
-        tasks.push_back(task);
-        history.addMemento(task.save());
+    // Bytes held by the loaded undo entries and the redo stack.
+    size_t memoryBytes() const {
+        return undoBytes + redoBytes;
     }
 
-    void markTaskCompleted(int index) {
-        if (index >= 0 && index < tasks.size() && !tasks[index].isCompleted()) {
-            history.addMemento(tasks[index].save());
-            tasks[index].markCompleted();
+    // Frees at least bytes of undo history, oldest first. Loaded entries whose records are still
+    // in the file go back to being unloaded, which loses nothing. Only if that is not enough are
+    // entries forgotten, and then the unloaded ones go too: undo must not skip a change, so what
+    // stays reachable has to be a contiguous run up to the present. A step is never split:
+    // entries chained to a dropped one go with it. The redo stack goes last. Returns the number
+    // of entries forgotten.
+    size_t dropOldest(size_t bytes) {
+        size_t target = memoryBytes() > bytes ? memoryBytes() - bytes : 0;
+        while (!savedLengths.empty() && memoryBytes() > target) {
+            undoBytes -= history.front().footprint();
+            history.pop_front();
+            unloadedEnd += savedLengths.front();
+            ++unloadedCount;
+            savedLengths.pop_front();
+        }
+        size_t dropped = 0;
+        if (!history.empty() && memoryBytes() > target) {
+            dropped += unloadedCount;
+            unloadedEnd = 0;
+            unloadedCount = 0;
+            forgottenIds.clear();
+        }
+        while (!history.empty() && memoryBytes() > target) {
+            do {
+                undoBytes -= history.front().footprint();
+                history.pop_front();
+                ++dropped;
+            } while (!history.empty() && history.front().isChained());
+        }
+        if (memoryBytes() > target) {
+            dropped += redoStack.size();
+            redoStack.clear();
+            redoBytes = 0;
         }
+        history.shrink_to_fit();
+        redoStack.shrink_to_fit();
+        return dropped;
     }
 
-    void markTaskPending(int index) {
-        if (index >= 0 && index < tasks.size() && tasks[index].isCompleted()) {
-            history.addMemento(tasks[index].save());
-            tasks[index].markPending();
+    // Records written before the last change to their layout are read with their own; they are
+    // loaded at once, so the next save rewrites the whole file in the current one.
+    void attachFile(const string& path, uint64_t end, size_t count, int version = stateFormatVersion) {
+        historyPath = path;
+        unloadedEnd = end;
+        unloadedCount = count;
+        recordVersion = version;
+        while (recordVersion < recordLayoutVersion && unloadedCount > 0) {
+            loadOlder();
         }
+        savedLengths.clear(); // Records in an old layout are not read again
+        recordVersion = stateFormatVersion;
     }
 
-    void deleteTask(int index) {
-        if (index >= 0 && index < tasks.size()) {
-            history.addMemento(tasks[index].save());
-            tasks.erase(tasks.begin() + index);
+    // Turns every entry for the given tasks into one that leaves them absent, so neither undo nor
+    // redo can bring back a purged task. The entries keep their places, so step counts and
+    // checkpoint depths stay valid. Entries still in the file are rewritten as they are loaded.
+    void forgetTasks(const unordered_set<long long>& ids) {
+        for (TaskMemento& memento : history) {
+            forgetIfListed(memento, ids, undoBytes);
+        }
+        for (TaskMemento& memento : redoStack) {
+            forgetIfListed(memento, ids, redoBytes);
+        }
+        if (unloadedCount > 0 || !savedLengths.empty()) {
+            forgottenIds.insert(ids.begin(), ids.end());
         }
     }
 
-    void viewTasks(const string& filter) const {
-        cout << "Tasks:" << endl;
-
-        for (size_t i = 0; i < tasks.size(); ++i) {
-            if (filter == "Show all" ||
-                (filter == "Show completed" && tasks[i].isCompleted()) ||
-                (filter == "Show pending" && !tasks[i].isCompleted())) {
-                tasks[i].display(i);
-            }
+    // First half of a save: writes the records that replace the file from tailStart on (the
+    // loaded part of the undo stack) to pendingPath, tagged with sequence. The history file
+    // itself is not touched until the state file naming this sequence is in place.
+    bool writePendingTail(const string& path, const string& pendingPath, uint64_t sequence, uint64_t& tailStart,
+                          uint64_t& fileEnd, size_t& count) {
+        if (path != historyPath) {
+            unloadedEnd = 0;
+            unloadedCount = 0;
+            savedLengths.clear();
+            forgottenIds.clear();
+            historyPath = path;
+        }
+        pendingLengths.clear();
+        string tail;
+        for (int shift = 0; shift < 64; shift += 8) {
+            tail += static_cast<char>(sequence >> shift);
         }
+        for (const TaskMemento& memento : history) {
+            BinaryWriter writer;
+            writer.writeMemento(memento);
+            uint32_t length = static_cast<uint32_t>(writer.data().size());
+            char lengthBytes[4] = {static_cast<char>(length), static_cast<char>(length >> 8), static_cast<char>(length >> 16),
+                                   static_cast<char>(length >> 24)};
+            tail += writer.data();
+            tail.append(lengthBytes, sizeof(lengthBytes));
+            pendingLengths.push_back(length + sizeof(lengthBytes));
+        }
+        if (!writeFileAtomically(pendingPath, tail)) {
+            return false;
+        }
+        tailStart = unloadedEnd;
+        fileEnd = unloadedEnd + tail.size() - pendingHeaderSize;
+        count = depth();
+        return true;
     }
 
-    void undo() {
-        if (!history.isEmpty()) {
-            TaskMemento memento = history.getMemento();
-            redoStack.addMemento(memento); // Store in redo stack before restoring
-            for (auto& task : tasks) {
-                if (task.getDescription() == memento.getDescription()) {
-                    task.restore(memento);
-                    break;
-                }
+    // Second half: cuts the history file at tailStart and appends the pending records, if the
+    // pending file carries sequence. Repeating it is harmless, so a save interrupted after the
+    // state file was replaced is finished by the next load. A pending file with another
+    // sequence belongs to a save that never committed and is discarded unapplied.
+    static bool applyPendingTail(const string& path, const string& pendingPath, uint64_t sequence, uint64_t tailStart) {
+        string tail;
+        if (!readFile(pendingPath, tail)) {
+            return false;
+        }
+        uint64_t pendingSequence = 0;
+        for (int shift = 0; shift < 64 && tail.size() >= pendingHeaderSize; shift += 8) {
+            pendingSequence |= static_cast<uint64_t>(static_cast<unsigned char>(tail[shift / 8])) << shift;
+        }
+        if (tail.size() < pendingHeaderSize || pendingSequence != sequence) {
+            remove(pendingPath.c_str());
+            return false;
+        }
+        {
+            ofstream create(path, ios::binary | ios::app);
+            if (!create) {
+                return false;
             }
-            cout << "Undo successful." << endl;
-        } else {
-            cout << "Nothing to undo." << endl;
         }
+        error_code error;
+        filesystem::resize_file(path, tailStart, error);
+        if (error) {
+            return false;
+        }
+        ofstream out(path, ios::binary | ios::app);
+        if (!out.write(tail.data() + pendingHeaderSize, tail.size() - pendingHeaderSize) || !out.flush()) {
+            return false;
+        }
+        out.close();
+        remove(pendingPath.c_str());
+        return true;
     }
 
-    void redo() {
-        if (!redoStack.isRedoStackEmpty()) {
-            TaskMemento memento = redoStack.redo();
-            history.addMemento(memento);
-            for (auto& task : tasks) {
-                if (task.getDescription() == memento.getDescription()) {
-                    task.restore(memento);
-                    break;
-                }
-            }
-            cout << "Redo successful." << endl;
-        } else {
-            cout << "Nothing to redo." << endl;
+    // Called once the pending records are in the history file (saved) or when they may not be:
+    // only records known to be in the file can be unloaded again.
+    void finishSave(bool saved) {
+        savedLengths.assign(saved ? pendingLengths.begin() : pendingLengths.end(), pendingLengths.end());
+        pendingLengths.clear();
+        if (saved && unloadedCount == 0) {
+            forgottenIds.clear();
         }
     }
 
-private:
-    vector<Task> tasks;
-    TaskHistory history;
-    TaskHistory redoStack;
-};
-
-int main() {
-    ToDoListManager manager;
-
-    while (true) {
-        cout << "What would you like to do?" << endl;
-        cout << "1. Add a new task" << endl;
-        cout << "2. Mark a task as completed" << endl;
-        cout << "3. Mark a task as pending" << endl;
-        cout << "4. Delete a task" << endl;
-        cout << "5. View all tasks" << endl;
-        cout << "6. View completed tasks" << endl;
-        cout << "7. View pending tasks" << endl;
-        cout << "8. Undo" << endl;
-        cout << "9. Redo" << endl;
-        cout << "10. Exit" << endl;
+    void writeRedo(BinaryWriter& writer) const {
+        writer.writeUnsigned(redoStack.size());
+        for (const TaskMemento& memento : redoStack) {
+            writer.writeMemento(memento);
+        }
+    }
 
-        int choice;
-        cin >> choice;
+    bool readRedo(BinaryReader& reader) {
+        uint64_t count;
+        if (!reader.readUnsigned(count)) {
+            return false;
+        }
+        vector<TaskMemento> loaded;
+        size_t loadedBytes = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            unique_ptr<TaskMemento> memento;
+            if (!reader.readMemento(memento)) {
+                return false;
+            }
+            loaded.push_back(*memento);
+            loadedBytes += loaded.back().footprint();
+        }
+        redoStack.swap(loaded);
+        redoBytes = loadedBytes;
+        return true;
+    }
 
-        switch (choice) {
-            case 1: {
-                string description, due_date;
-                cout << "Enter task description: ";
-                cin.ignore();
-                getline(cin, description);
+    // IDs of purged tasks whose entries may still be in the unloaded part of the file.
+    void writeForgotten(BinaryWriter& writer) const {
+        vector<long long> ids(forgottenIds.begin(), forgottenIds.end());
+        sort(ids.begin(), ids.end());
+        writer.writeUnsigned(ids.size());
+        long long previous = 0;
+        for (long long id : ids) {
+            writer.writeSigned(id - previous);
+            previous = id;
+        }
+    }
 
-                string addDueDate;
-                cout << "Do you want to add a due date? (y/n): ";
-                cin >> addDueDate;
+    bool readForgotten(BinaryReader& reader) {
+        uint64_t count;
+        if (!reader.readUnsigned(count)) {
+            return false;
+        }
+        unordered_set<long long> loaded;
+        long long id = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            long long delta;
+            if (!reader.readSigned(delta)) {
+                return false;
+            }
+            id += delta;
+            loaded.insert(id);
+        }
+        forgottenIds.swap(loaded);
+        return true;
+    }
 
-                if (addDueDate == "y" || addDueDate == "Y") {
-                    cout << "Enter due date (YYYY-MM-DD): ";
-                    cin >> due_date;
-                }
+private:
+    static void forgetIfListed(TaskMemento& memento, const unordered_set<long long>& ids, size_t& bytes) {
+        if (!memento.isPresent() || ids.count(memento.getTaskId()) == 0) {
+            return;
+        }
+        TaskMemento forgotten = TaskMemento::absent(memento.getTaskId(), memento.getPosition());
+        forgotten.setRecordedAt(memento.getRecordedAt());
+        forgotten.setChained(memento.isChained());
+        bytes = bytes - memento.footprint() + forgotten.footprint();
+        memento = forgotten;
+    }
 
-                Task task = Task::Builder(description).setDueDate(due_date).build();
-                manager.addTask(task);
-                cout << "Task added successfully!" << endl;
-                break;
-            }
-            case 2: {
-                int index;
-                cout << "Enter task index: ";
-                cin >> index;
-                manager.markTaskCompleted(index - 1);
-                cout << "Task marked as completed!" << endl;
+    // Reads up to loadBatch records preceding unloadedEnd. An unreadable file drops the
+    // remaining unloaded history rather than failing the undo.
+    void loadOlder() {
+        ifstream in(historyPath, ios::binary);
+        vector<TaskMemento> loaded;
+        while (in && unloadedCount > 0 && loaded.size() < loadBatch && unloadedEnd >= 4) {
+            char lengthBytes[4];
+            in.seekg(static_cast<streamoff>(unloadedEnd - 4));
+            if (!in.read(lengthBytes, sizeof(lengthBytes))) {
                 break;
             }
-            case 3: {
-                int index;
-                cout << "Enter task index: ";
-                cin >> index;
-                manager.markTaskPending(index - 1);
-                cout << "Task marked as pending!" << endl;
+            uint32_t length = static_cast<uint32_t>(static_cast<unsigned char>(lengthBytes[0])) |
+                              static_cast<uint32_t>(static_cast<unsigned char>(lengthBytes[1])) << 8 |
+                              static_cast<uint32_t>(static_cast<unsigned char>(lengthBytes[2])) << 16 |
+                              static_cast<uint32_t>(static_cast<unsigned char>(lengthBytes[3])) << 24;
+            if (length + 4 > unloadedEnd) {
                 break;
             }
-            case 4: {
-                int index;
-                cout << "Enter task index: ";
-                cin >> index;
-                manager.deleteTask(index - 1);
-                cout << "Task deleted successfully!" << endl;
+            string payload(length, '\0');
+            in.seekg(static_cast<streamoff>(unloadedEnd - 4 - length));
+            if (!in.read(&payload[0], length)) {
                 break;
             }
-            case 5: {
-                manager.viewTasks("Show all");
+            BinaryReader reader(payload.data(), payload.size(), recordVersion);
+            unique_ptr<TaskMemento> memento;
+            if (!reader.readMemento(memento)) {
                 break;
             }
-            case 6: {
-                manager.viewTasks("Show completed");
-                break;
+            if (!forgottenIds.empty()) {
+                size_t ignored = 0;
+                forgetIfListed(*memento, forgottenIds, ignored);
             }
-            case 7: {
-                manager.viewTasks("Show pending");
+            loaded.push_back(*memento);
+            unloadedEnd -= length + 4;
+            --unloadedCount;
+            savedLengths.push_front(length + 4);
+        }
+        if (loaded.empty()) {
+            unloadedEnd = 0;
+            unloadedCount = 0;
+        }
+        if (unloadedCount == 0 && savedLengths.empty()) {
+            forgottenIds.clear();
+        }
+        if (loaded.empty()) {
+            return;
+        }
+        history.insert(history.begin(), loaded.rbegin(), loaded.rend());
+        for (size_t i = 0; i < loaded.size(); ++i) {
+            undoBytes += history[i].footprint();
+        }
+    }
+
+    static const int recordLayoutVersion = 4; // Last format version that changed the record layout
+    static const size_t loadBatch = 64;
+    static const size_t pendingHeaderSize = 8; // Little-endian save sequence
+
+    deque<TaskMemento> history;
+    vector<TaskMemento> redoStack;
+    string historyPath;
+    uint64_t unloadedEnd = 0;
+    size_t unloadedCount = 0;
+    deque<uint32_t> savedLengths;   // Record sizes of the oldest loaded entries, still in the file from unloadedEnd on
+    vector<uint32_t> pendingLengths; // Record sizes of the tail being saved
+    int recordVersion = stateFormatVersion;
+    unordered_set<long long> forgottenIds; // Purged tasks; their unloaded entries are forgotten on load
+    size_t undoBytes = 0;
+    size_t redoBytes = 0;
+    long long coalesceWindowMillis = 1000;
+    size_t coalescedEntries = 0;
+    bool coalesceBarrier = false;
+};
+
+const size_t minTasksPerWorker = 65536;
+
+// Splits tasks into one contiguous chunk per hardware thread and returns the slots accepted by
+// the predicate, in order. makeMatcher is called once per worker so matchers may keep mutable state.
+template <typename MatcherFactory>
+vector<size_t> parallelSelect(const vector<Task>& tasks, MatcherFactory makeMatcher) {
+    size_t workers = thread::hardware_concurrency();
+    if (workers == 0) {
+        workers = 1;
+    }
+    workers = min(workers, max<size_t>(1, tasks.size() / minTasksPerWorker));
+
+    vector<vector<size_t>> partial(workers);
+    auto scanRange = [&](size_t worker) {
+        auto matches = makeMatcher();
+        size_t begin = tasks.size() * worker / workers;
+        size_t end = tasks.size() * (worker + 1) / workers;
+        for (size_t i = begin; i < end; ++i) {
+            if (matches(tasks[i])) {
+                partial[worker].push_back(i);
+            }
+        }
+    };
+
+    if (workers == 1) {
+        scanRange(0);
+        return partial[0];
+    }
+
+    vector<thread> threads;
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back(scanRange, w);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    vector<size_t> slots;
+    for (const auto& chunk : partial) {
+        slots.insert(slots.end(), chunk.begin(), chunk.end());
+    }
+    return slots;
+}
+
+class DescriptionScanner {
+public:
+    // Returns the slots of all tasks whose description contains query, ignoring ASCII case.
+    vector<size_t> scan(const vector<Task>& tasks, const string& query) const {
+        const string needle = toLowerAscii(query);
+        return parallelSelect(tasks, [&needle]() {
+            return [&needle](const Task& task) {
+                return containsLower(task.getLowerDescription(), needle);
+            };
+        });
+    }
+
+    // Both arguments must already be lowercase. Candidate positions are found by comparing the
+    // first and last needle bytes a whole vector at a time; only those are verified with memcmp.
+    static bool containsLower(const string& haystack, const string& needle) {
+        const size_t n = haystack.size();
+        const size_t k = needle.size();
+        if (k == 0) {
+            return true;
+        }
+        if (k > n) {
+            return false;
+        }
+
+        const char* h = haystack.data();
+        const char* nd = needle.data();
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256i first256 = _mm256_set1_epi8(nd[0]);
+        const __m256i last256 = _mm256_set1_epi8(nd[k - 1]);
+        for (; i + k + 31 <= n; i += 32) {
+            __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+            __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i + k - 1));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first256, blockFirst), _mm256_cmpeq_epi8(last256, blockLast))));
+            while (mask != 0) {
+                if (memcmp(h + i + __builtin_ctz(mask), nd, k) == 0) {
+                    return true;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i first128 = _mm_set1_epi8(nd[0]);
+        const __m128i last128 = _mm_set1_epi8(nd[k - 1]);
+        for (; i + k + 15 <= n; i += 16) {
+            __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+            __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i + k - 1));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first128, blockFirst), _mm_cmpeq_epi8(last128, blockLast))));
+            while (mask != 0) {
+                if (memcmp(h + i + __builtin_ctz(mask), nd, k) == 0) {
+                    return true;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i + k <= n; ++i) {
+            if (h[i] == nd[0] && memcmp(h + i, nd, k) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Substring search driven one keystroke at a time. Extending the query only re-checks the
+// tasks that matched the shorter query; deleting characters returns to the result already
+// computed for that prefix. Work is done in bounded steps so a caller can show the matches
+// found so far and react to the next keystroke before the scan finishes.
+class SearchSession {
+public:
+    // Any change to the task list (a new generation) discards all cached results.
+    void setQuery(const string& text, size_t taskCount, uint64_t taskGeneration) {
+        string lowered = toLowerAscii(text);
+        if (taskGeneration != generation || taskCount != scannedCount) {
+            generation = taskGeneration;
+            scannedCount = taskCount;
+            prefixes.clear();
+            restart(lowered);
+            return;
+        }
+        if (lowered == query) {
+            return;
+        }
+        while (!prefixes.empty() && lowered.compare(0, prefixes.back().first.size(), prefixes.back().first) != 0) {
+            prefixes.pop_back();
+        }
+        if (!prefixes.empty() && prefixes.back().first == lowered) {
+            query = lowered;
+            matches = prefixes.back().second;
+            candidates.clear();
+            candidatePos = 0;
+            allFrom = allEnd = 0;
+            return;
+        }
+        if (lowered.compare(0, query.size(), query) == 0) {
+            // Narrowing: the new matches are among the old matches plus whatever the old
+            // query had not reached yet, and both keep their slot order.
+            vector<size_t> remaining = move(matches);
+            remaining.insert(remaining.end(), candidates.begin() + candidatePos, candidates.end());
+            query = lowered;
+            candidates = move(remaining);
+            candidatePos = 0;
+            matches.clear();
+            return;
+        }
+        if (!prefixes.empty()) {
+            query = lowered;
+            candidates = prefixes.back().second;
+            candidatePos = 0;
+            allFrom = allEnd = 0;
+            matches.clear();
+            return;
+        }
+        restart(lowered);
+    }
+
+    // Checks up to budget more tasks; returns true once the scan is complete.
+    bool step(const vector<Task>& tasks, size_t budget) {
+        while (budget > 0 && candidatePos < candidates.size()) {
+            size_t slot = candidates[candidatePos++];
+            if (DescriptionScanner::containsLower(tasks[slot].getLowerDescription(), query)) {
+                matches.push_back(slot);
+            }
+            --budget;
+        }
+        while (budget > 0 && allFrom < allEnd) {
+            size_t slot = allFrom++;
+            if (DescriptionScanner::containsLower(tasks[slot].getLowerDescription(), query)) {
+                matches.push_back(slot);
+            }
+            --budget;
+        }
+        if (!isDone()) {
+            return false;
+        }
+        if (prefixes.empty() || prefixes.back().first != query) {
+            prefixes.emplace_back(query, matches);
+        }
+        return true;
+    }
+
+    bool isDone() const {
+        return candidatePos == candidates.size() && allFrom == allEnd;
+    }
+
+    // Slots of the matches found so far, in ascending order.
+    const vector<size_t>& getMatches() const {
+        return matches;
+    }
+
+    // Generation of the task list the matches refer to.
+    uint64_t getGeneration() const {
+        return generation;
+    }
+
+private:
+    void restart(const string& lowered) {
+        query = lowered;
+        matches.clear();
+        candidates.clear();
+        candidatePos = 0;
+        allFrom = 0;
+        allEnd = scannedCount;
+    }
+
+    string query;
+    vector<size_t> matches;
+    vector<size_t> candidates; // Checked first, then the slot range [allFrom, allEnd)
+    size_t candidatePos = 0;
+    size_t allFrom = 0;
+    size_t allEnd = 0;
+    uint64_t generation = numeric_limits<uint64_t>::max();
+    size_t scannedCount = 0;
+    vector<pair<string, vector<size_t>>> prefixes; // Completed results for prefixes of the query
+};
+
+// Regular expressions compiled to a Thompson NFA and executed as a lazily built DFA, so matching
+// never backtracks and runs in time linear in the text. Supports literals, '.', character
+// classes, \d \w \s escapes, grouping, '|', '*', '+', '?', and '^'/'$' at the ends of each
+// top-level alternative. Alternatives anchored with '^' are only started at the beginning of the
+// text; those anchored with '$' lead to a match state that counts only at its end.
+class RegexMatcher {
+public:
+    bool compile(const string& regex) {
+        pattern = regex;
+        pos = 0;
+        patternEnd = pattern.size();
+        error.clear();
+        nfa.clear();
+
+        int match = addState(NfaState::Match);
+        int matchAtEnd = addState(NfaState::MatchAtEnd);
+        vector<int> starts;
+        vector<int> floatingStarts;
+        while (error.empty()) {
+            bool anchoredStart = !atEnd() && pattern[pos] == '^';
+            if (anchoredStart) {
+                ++pos;
+            }
+            Fragment branch = parseConcatenation(true);
+            bool anchoredEnd = !atEnd() && pattern[pos] == '$';
+            if (anchoredEnd) {
+                ++pos;
+            }
+            patch(branch.outs, anchoredEnd ? matchAtEnd : match);
+            starts.push_back(branch.start);
+            if (!anchoredStart) {
+                floatingStarts.push_back(branch.start);
+            }
+            if (atEnd() || pattern[pos] != '|') {
+                break;
+            }
+            ++pos;
+        }
+        if (error.empty() && pos != patternEnd) {
+            error = "unexpected '" + string(1, pattern[pos]) + "'";
+        }
+        if (!error.empty()) {
+            return false;
+        }
+        nfaStart = joinStarts(starts);
+        floatingStart = joinStarts(floatingStarts);
+        requiredLiteral = extractRequiredLiteral();
+        resetDfa();
+        return true;
+    }
+
+    const string& getError() const {
+        return error;
+    }
+
+    // A lowercase substring every match must contain, or empty if none could be derived.
+    const string& getRequiredLiteral() const {
+        return requiredLiteral;
+    }
+
+    bool matches(const string& text) {
+        int state = dfaStart;
+        if (dfa[state].accepting) {
+            return true;
+        }
+        for (unsigned char c : text) {
+            state = step(state, c);
+            if (dfa[state].accepting) {
+                return true;
+            }
+        }
+        return dfa[state].acceptingAtEnd;
+    }
+
+private:
+    struct NfaState {
+        enum Kind { Char, Split, Epsilon, Match, MatchAtEnd };
+        Kind kind;
+        bitset<256> chars;
+        int out = -1;
+        int out1 = -1;
+    };
+
+    struct Fragment {
+        int start;
+        vector<pair<int, int>> outs; // (state, 0 for out / 1 for out1) still to be patched
+    };
+
+    struct DfaState {
+        vector<int> nfaStates;
+        bool accepting;      // A match ends here, whatever follows
+        bool acceptingAtEnd; // A match ends here if the text does
+        array<int, 256> next;
+    };
+
+    int addState(NfaState::Kind kind, const bitset<256>& chars = bitset<256>()) {
+        NfaState state;
+        state.kind = kind;
+        state.chars = chars;
+        nfa.push_back(state);
+        return static_cast<int>(nfa.size()) - 1;
+    }
+
+    void patch(const vector<pair<int, int>>& outs, int target) {
+        for (const auto& out : outs) {
+            (out.second == 0 ? nfa[out.first].out : nfa[out.first].out1) = target;
+        }
+    }
+
+    bool atEnd() const {
+        return pos >= patternEnd;
+    }
+
+    // A split state leading to each of starts, or -1 if there are none.
+    int joinStarts(const vector<int>& starts) {
+        if (starts.empty()) {
+            return -1;
+        }
+        int joined = starts[0];
+        for (size_t i = 1; i < starts.size(); ++i) {
+            int split = addState(NfaState::Split);
+            nfa[split].out = joined;
+            nfa[split].out1 = starts[i];
+            joined = split;
+        }
+        return joined;
+    }
+
+    Fragment parseAlternation() {
+        Fragment left = parseConcatenation(false);
+        while (error.empty() && !atEnd() && pattern[pos] == '|') {
+            ++pos;
+            Fragment right = parseConcatenation(false);
+            int split = addState(NfaState::Split);
+            nfa[split].out = left.start;
+            nfa[split].out1 = right.start;
+            left.start = split;
+            left.outs.insert(left.outs.end(), right.outs.begin(), right.outs.end());
+        }
+        return left;
+    }
+
+    // At the top level, a '$' that ends the alternative is left for compile to take as an anchor.
+    Fragment parseConcatenation(bool topLevel) {
+        int empty = addState(NfaState::Epsilon);
+        Fragment result{empty, {{empty, 0}}};
+        while (error.empty() && !atEnd() && pattern[pos] != '|' && pattern[pos] != ')') {
+            if (topLevel && pattern[pos] == '$' && (pos + 1 == patternEnd || pattern[pos + 1] == '|')) {
+                break;
+            }
+            Fragment next = parseRepetition();
+            patch(result.outs, next.start);
+            result.outs = next.outs;
+        }
+        return result;
+    }
+
+    Fragment parseRepetition() {
+        Fragment atom = parseAtom();
+        while (error.empty() && !atEnd() && (pattern[pos] == '*' || pattern[pos] == '+' || pattern[pos] == '?')) {
+            char op = pattern[pos++];
+            int split = addState(NfaState::Split);
+            nfa[split].out = atom.start;
+            if (op == '*') {
+                patch(atom.outs, split);
+                atom = Fragment{split, {{split, 1}}};
+            } else if (op == '+') {
+                patch(atom.outs, split);
+                atom.outs = {{split, 1}};
+            } else {
+                atom.outs.push_back({split, 1});
+                atom.start = split;
+            }
+        }
+        return atom;
+    }
+
+    Fragment parseAtom() {
+        char c = pattern[pos++];
+        bitset<256> chars;
+        switch (c) {
+            case '(': {
+                Fragment inner = parseAlternation();
+                if (error.empty() && (atEnd() || pattern[pos] != ')')) {
+                    error = "missing ')'";
+                }
+                ++pos;
+                return inner;
+            }
+            case '.':
+                chars.set();
+                break;
+            case '[':
+                parseClass(chars);
+                break;
+            case '\\':
+                parseEscape(chars);
+                break;
+            case '*':
+            case '+':
+            case '?':
+                error = "nothing to repeat before '" + string(1, c) + "'";
+                break;
+            case '^':
+            case '$':
+                error = "anchors are only supported at the ends of a top-level alternative";
+                break;
+            default:
+                chars.set(static_cast<unsigned char>(c));
+                break;
+        }
+        int state = addState(NfaState::Char, chars);
+        return Fragment{state, {{state, 0}}};
+    }
+
+    void parseEscape(bitset<256>& chars) {
+        if (atEnd()) {
+            error = "trailing '\\'";
+            return;
+        }
+        char c = pattern[pos++];
+        switch (c) {
+            case 'd':
+                for (int ch = '0'; ch <= '9'; ++ch) chars.set(ch);
+                break;
+            case 'w':
+                for (int ch = 0; ch < 256; ++ch) {
+                    if (isalnum(ch) || ch == '_') chars.set(ch);
+                }
+                break;
+            case 's':
+                for (char ch : string(" \t\n\r\f\v")) chars.set(static_cast<unsigned char>(ch));
+                break;
+            case 'n':
+                chars.set('\n');
+                break;
+            case 't':
+                chars.set('\t');
+                break;
+            default:
+                chars.set(static_cast<unsigned char>(c));
+                break;
+        }
+    }
+
+    void parseClass(bitset<256>& chars) {
+        bool negated = !atEnd() && pattern[pos] == '^';
+        if (negated) {
+            ++pos;
+        }
+        bool first = true;
+        while (!atEnd() && (pattern[pos] != ']' || first)) {
+            first = false;
+            unsigned char low = static_cast<unsigned char>(pattern[pos++]);
+            if (low == '\\' && !atEnd()) {
+                bitset<256> escaped;
+                parseEscape(escaped);
+                chars |= escaped;
+                continue;
+            }
+            if (pos + 1 < patternEnd && pattern[pos] == '-' && pattern[pos + 1] != ']') {
+                unsigned char high = static_cast<unsigned char>(pattern[pos + 1]);
+                pos += 2;
+                for (int ch = low; ch <= high; ++ch) chars.set(ch);
+            } else {
+                chars.set(low);
+            }
+        }
+        if (atEnd()) {
+            error = "missing ']'";
+            return;
+        }
+        ++pos;
+        if (negated) {
+            chars.flip();
+        }
+    }
+
+    // Conservative: only plain characters at the top level of a pattern without alternation,
+    // and never ones made optional by a following '*' or '?'.
+    string extractRequiredLiteral() const {
+        string best;
+        string run;
+        int depth = 0;
+        size_t end = patternEnd;
+        if (end > 0 && pattern[end - 1] == '$' && (end < 2 || pattern[end - 2] != '\\')) {
+            --end;
+        }
+        size_t i = !pattern.empty() && pattern[0] == '^' ? 1 : 0;
+        for (; i < end; ++i) {
+            char c = pattern[i];
+            char next = i + 1 < end ? pattern[i + 1] : '\0';
+            if (c == '|' && depth == 0) {
+                return string();
+            }
+            bool plain = depth == 0 && string("()[].*+?\\|").find(c) == string::npos;
+            if (plain && next != '*' && next != '?') {
+                run += c;
+                if (next == '+') {
+                    best = run.size() > best.size() ? run : best;
+                    run.clear();
+                }
+                continue;
+            }
+            best = run.size() > best.size() ? run : best;
+            run.clear();
+            if (c == '(') {
+                ++depth;
+            } else if (c == ')') {
+                --depth;
+            } else if (c == '\\' || c == '[') {
+                // Skip over the escape or class body so its characters are not read as structure.
+                if (c == '\\') {
+                    ++i;
+                } else {
+                    ++i;
+                    if (i < end && pattern[i] == '^') ++i;
+                    if (i < end && pattern[i] == ']') ++i;
+                    while (i < end && pattern[i] != ']') {
+                        if (pattern[i] == '\\') ++i;
+                        ++i;
+                    }
+                }
+            }
+        }
+        best = run.size() > best.size() ? run : best;
+        return toLowerAscii(best);
+    }
+
+    void addClosure(vector<int>& set, vector<bool>& seen, int state) const {
+        if (state < 0 || seen[state]) {
+            return;
+        }
+        seen[state] = true;
+        const NfaState& s = nfa[state];
+        if (s.kind == NfaState::Split) {
+            addClosure(set, seen, s.out);
+            addClosure(set, seen, s.out1);
+        } else if (s.kind == NfaState::Epsilon) {
+            addClosure(set, seen, s.out);
+        } else {
+            set.push_back(state);
+        }
+    }
+
+    int internState(vector<int> set) {
+        sort(set.begin(), set.end());
+        auto found = dfaIndex.find(set);
+        if (found != dfaIndex.end()) {
+            return found->second;
+        }
+        DfaState state;
+        state.accepting = false;
+        state.acceptingAtEnd = false;
+        for (int s : set) {
+            if (nfa[s].kind == NfaState::Match) {
+                state.accepting = true;
+                state.acceptingAtEnd = true;
+            } else if (nfa[s].kind == NfaState::MatchAtEnd) {
+                state.acceptingAtEnd = true;
+            }
+        }
+        state.nfaStates = set;
+        state.next.fill(-1);
+        dfa.push_back(state);
+        int id = static_cast<int>(dfa.size()) - 1;
+        dfaIndex[set] = id;
+        return id;
+    }
+
+    void resetDfa() {
+        dfa.clear();
+        dfaIndex.clear();
+        vector<int> set;
+        vector<bool> seen(nfa.size(), false);
+        addClosure(set, seen, nfaStart);
+        dfaStart = internState(set);
+    }
+
+    int step(int state, unsigned char c) {
+        int cached = dfa[state].next[c];
+        if (cached >= 0) {
+            return cached;
+        }
+
+        vector<int> set;
+        vector<bool> seen(nfa.size(), false);
+        for (int s : dfa[state].nfaStates) {
+            if (nfa[s].kind == NfaState::Char && nfa[s].chars.test(c)) {
+                addClosure(set, seen, nfa[s].out);
+            }
+        }
+        addClosure(set, seen, floatingStart);
+
+        // The cache is bounded; when full it is dropped and rebuilt on demand.
+        if (dfa.size() >= maxDfaStates) {
+            resetDfa();
+            return internState(set);
+        }
+        int next = internState(set);
+        dfa[state].next[c] = next;
+        return next;
+    }
+
+    static const size_t maxDfaStates = 2048;
+
+    string pattern;
+    size_t pos = 0;
+    size_t patternEnd = 0;
+    string error;
+    vector<NfaState> nfa;
+    int nfaStart = 0;      // All alternatives, entered at the beginning of the text
+    int floatingStart = -1; // The alternatives not anchored with '^', entered at every position
+    string requiredLiteral;
+    vector<DfaState> dfa;
+    map<vector<int>, int> dfaIndex;
+    int dfaStart = 0;
+};
+
+vector<string> splitWords(const string& lowered) {
+    vector<string> words;
+    string word;
+    for (char c : lowered) {
+        if (isalnum(static_cast<unsigned char>(c))) {
+            word += c;
+        } else if (!word.empty()) {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+    if (!word.empty()) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// Typo-tolerant lookup over the words of all task descriptions. The term dictionary keeps a
+// sorted posting list of task IDs per word; a BK-tree over the dictionary answers "all words
+// within edit distance d" while visiting only a small part of the tree. Words whose posting
+// list empties stay in the tree as tombstones until they outnumber live words, then the tree
+// is rebuilt.
+class FuzzyWordIndex {
+public:
+    void add(const Task& task) {
+        for (const string& word : splitWords(task.getLowerDescription())) {
+            vector<long long>& ids = postings[word];
+            if (ids.empty()) {
+                if (nodeIndex.count(word) == 0) {
+                    insertNode(word);
+                } else {
+                    --deadNodes;
+                }
+            }
+            // IDs mostly arrive in increasing order, so this is usually an append.
+            auto position = lower_bound(ids.begin(), ids.end(), task.getId());
+            if (position == ids.end() || *position != task.getId()) {
+                ids.insert(position, task.getId());
+                ++postingCount;
+            }
+        }
+    }
+
+    void remove(const Task& task) {
+        for (const string& word : splitWords(task.getLowerDescription())) {
+            auto found = postings.find(word);
+            if (found == postings.end()) {
+                continue;
+            }
+            vector<long long>& ids = found->second;
+            auto position = lower_bound(ids.begin(), ids.end(), task.getId());
+            if (position == ids.end() || *position != task.getId()) {
+                continue;
+            }
+            ids.erase(position);
+            --postingCount;
+            if (ids.empty()) {
+                postings.erase(found);
+                ++deadNodes;
+            }
+        }
+        if (deadNodes > postings.size() && nodes.size() > minNodesBeforeCompaction) {
+            rebuild();
+        }
+    }
+
+    // IDs of the tasks that contain, for every term, some word within the term's edit distance
+    // (1 for terms of up to four letters, 2 otherwise). Sorted ascending.
+    vector<long long> matchAll(const vector<string>& terms) const {
+        vector<long long> result;
+        for (size_t i = 0; i < terms.size(); ++i) {
+            vector<long long> matches;
+            for (const string& word : search(terms[i], terms[i].size() <= 4 ? 1 : 2)) {
+                const vector<long long>& ids = postings.at(word);
+                matches.insert(matches.end(), ids.begin(), ids.end());
+            }
+            sort(matches.begin(), matches.end());
+            matches.erase(unique(matches.begin(), matches.end()), matches.end());
+            if (i == 0) {
+                result = move(matches);
+            } else {
+                vector<long long> both;
+                set_intersection(result.begin(), result.end(), matches.begin(), matches.end(), back_inserter(both));
+                result = move(both);
+            }
+            if (result.empty()) {
+                break;
+            }
+        }
+        return result;
+    }
+
+    vector<string> search(const string& term, int maxDistance) const {
+        vector<string> matches;
+        if (nodes.empty()) {
+            return matches;
+        }
+        vector<int> pending{0};
+        while (!pending.empty()) {
+            const Node& node = nodes[pending.back()];
+            pending.pop_back();
+            int distance = editDistance(term, node.word, unboundedDistance);
+            if (distance <= maxDistance && postings.count(node.word) > 0) {
+                matches.push_back(node.word);
+            }
+            // Triangle inequality: only children at distance within [d - max, d + max] can match.
+            for (const auto& child : node.children) {
+                if (child.first >= distance - maxDistance && child.first <= distance + maxDistance) {
+                    pending.push_back(child.second);
+                }
+            }
+        }
+        return matches;
+    }
+
+    // Estimated: each dictionary word is stored three times (tree node and both maps), every
+    // node but the root is one entry in its parent's child map, and every posting is one ID.
+    size_t memoryBytes() const {
+        const size_t hashEntry = sizeof(string) + sizeof(vector<long long>) + 2 * sizeof(void*);
+        const size_t mapEntry = sizeof(pair<const int, int>) + 4 * sizeof(void*);
+        return nodes.capacity() * sizeof(Node) + nodes.size() * mapEntry + (nodeIndex.size() + postings.size()) * hashEntry +
+               (nodeIndex.bucket_count() + postings.bucket_count()) * sizeof(void*) + 3 * wordBytes +
+               postingCount * sizeof(long long);
+    }
+
+    void clear() {
+        nodes = vector<Node>();
+        nodeIndex = unordered_map<string, int>();
+        postings = unordered_map<string, vector<long long>>();
+        deadNodes = 0;
+        wordBytes = 0;
+        postingCount = 0;
+    }
+
+    // Levenshtein distance, returning limit + 1 as soon as every cell in a row exceeds limit.
+    static int editDistance(const string& a, const string& b, int limit) {
+        if (static_cast<int>(a.size()) - static_cast<int>(b.size()) > limit ||
+            static_cast<int>(b.size()) - static_cast<int>(a.size()) > limit) {
+            return limit + 1;
+        }
+        vector<int> previous(b.size() + 1);
+        vector<int> current(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); ++j) {
+            previous[j] = static_cast<int>(j);
+        }
+        for (size_t i = 1; i <= a.size(); ++i) {
+            current[0] = static_cast<int>(i);
+            int rowMin = current[0];
+            for (size_t j = 1; j <= b.size(); ++j) {
+                int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+                current[j] = min({previous[j] + 1, current[j - 1] + 1, previous[j - 1] + cost});
+                rowMin = min(rowMin, current[j]);
+            }
+            if (rowMin > limit) {
+                return limit + 1;
+            }
+            swap(previous, current);
+        }
+        return min(previous[b.size()], limit + 1);
+    }
+
+private:
+    struct Node {
+        string word;
+        map<int, int> children; // edit distance to child -> node index
+    };
+
+    void insertNode(const string& word) {
+        nodeIndex[word] = static_cast<int>(nodes.size());
+        wordBytes += stringHeapBytes(word);
+        if (nodes.empty()) {
+            nodes.push_back(Node{word, {}});
+            return;
+        }
+        int current = 0;
+        while (true) {
+            int distance = editDistance(word, nodes[current].word, unboundedDistance);
+            auto child = nodes[current].children.find(distance);
+            if (child == nodes[current].children.end()) {
+                nodes[current].children[distance] = static_cast<int>(nodes.size());
+                nodes.push_back(Node{word, {}});
+                return;
+            }
+            current = child->second;
+        }
+    }
+
+    void rebuild() {
+        nodes.clear();
+        nodeIndex.clear();
+        deadNodes = 0;
+        wordBytes = 0;
+        for (const auto& entry : postings) {
+            insertNode(entry.first);
+        }
+    }
+
+    static const size_t minNodesBeforeCompaction = 1024;
+    static const int unboundedDistance = numeric_limits<int>::max() - 1;
+
+    vector<Node> nodes;
+    unordered_map<string, int> nodeIndex;
+    unordered_map<string, vector<long long>> postings; // word -> sorted task IDs
+    size_t deadNodes = 0;
+    size_t wordBytes = 0;    // Heap bytes of the node words
+    size_t postingCount = 0; // Task IDs across all posting lists
+};
+
+class BloomFilter {
+public:
+    explicit BloomFilter(size_t expectedItems = 1024, size_t bitsPerItem = 10) {
+        reset(expectedItems, bitsPerItem);
+    }
+
+    void reset(size_t expectedItems, size_t bitsPerItem = 10) {
+        size_t bitCount = max<size_t>(64, expectedItems * bitsPerItem);
+        words.assign((bitCount + 63) / 64, 0);
+        hashCount = max<size_t>(1, static_cast<size_t>(bitsPerItem * 0.693 + 0.5));
+        insertedItems = 0;
+    }
+
+    void insert(uint64_t hash) {
+        forEachBit(hash, [this](size_t bit) { words[bit / 64] |= uint64_t(1) << (bit % 64); });
+        ++insertedItems;
+    }
+
+    bool mightContain(uint64_t hash) const {
+        bool present = true;
+        forEachBit(hash, [this, &present](size_t bit) {
+            present = present && (words[bit / 64] & (uint64_t(1) << (bit % 64))) != 0;
+        });
+        return present;
+    }
+
+    // (1 - e^(-kn/m))^k for the number of items inserted since the last reset.
+    double estimatedFalsePositiveRate() const {
+        double m = static_cast<double>(words.size() * 64);
+        return pow(1.0 - exp(-static_cast<double>(hashCount * insertedItems) / m), static_cast<double>(hashCount));
+    }
+
+    size_t memoryBytes() const {
+        return words.size() * sizeof(uint64_t);
+    }
+
+    size_t size() const {
+        return insertedItems;
+    }
+
+private:
+    // Double hashing: bit i is h1 + i * h2, with h2 forced odd so the probes never collapse.
+    template <typename Visit>
+    void forEachBit(uint64_t hash, Visit visit) const {
+        uint64_t h1 = hash;
+        uint64_t h2 = (hash >> 33 | hash << 31) * 0x9e3779b97f4a7c15ULL | 1;
+        size_t bitCount = words.size() * 64;
+        for (size_t i = 0; i < hashCount; ++i) {
+            visit(static_cast<size_t>((h1 + i * h2) % bitCount));
+        }
+    }
+
+    vector<uint64_t> words;
+    size_t hashCount = 1;
+    size_t insertedItems = 0;
+};
+
+struct DedupeStats {
+    size_t checks = 0;
+    size_t bloomNegatives = 0;
+    size_t bloomFalsePositives = 0;
+    size_t duplicatesRejected = 0;
+    double estimatedFalsePositiveRate = 0.0;
+    size_t bloomBytes = 0;
+    size_t exactIndexBytes = 0;
+};
+
+// Exact duplicate detection over normalized (description, due date, tags). The Bloom filter
+// answers most "definitely new" checks without touching the hash table; positives are confirmed
+// against the exact index, which is reference counted so deletes keep it accurate. Bloom bits
+// cannot be cleared, so the filter is rebuilt once it grows past capacity or goes stale.
+class DuplicateDetector {
+public:
+    static string normalizedKey(const Task& task) {
+        string key;
+        for (const string& word : splitWords(task.getLowerDescription())) {
+            key += key.empty() ? "" : " ";
+            key += word;
+        }
+        key += '\x1f';
+        key += task.getDueDate();
+        vector<string> tags;
+        for (const string& tag : task.getTags()) {
+            tags.push_back(toLowerAscii(tag));
+        }
+        sort(tags.begin(), tags.end());
+        for (const string& tag : tags) {
+            key += '\x1f';
+            key += tag;
+        }
+        return key;
+    }
+
+    bool isDuplicate(const Task& task) {
+        ++stats.checks;
+        string key = normalizedKey(task);
+        if (!bloom.mightContain(hashKey(key))) {
+            ++stats.bloomNegatives;
+            return false;
+        }
+        if (counts.count(key) == 0) {
+            ++stats.bloomFalsePositives;
+            return false;
+        }
+        ++stats.duplicatesRejected;
+        return true;
+    }
+
+    void add(const Task& task) {
+        string key = normalizedKey(task);
+        if (counts[key]++ == 0) {
+            keyBytes += key.capacity();
+            bloom.insert(hashKey(key));
+            if (bloom.size() > bloomCapacity) {
+                rebuildBloom();
+            }
+        }
+    }
+
+    void remove(const Task& task) {
+        auto found = counts.find(normalizedKey(task));
+        if (found == counts.end()) {
+            return;
+        }
+        if (--found->second == 0) {
+            keyBytes -= found->first.capacity();
+            counts.erase(found);
+            if (bloom.size() > 2 * counts.size() + 1024) {
+                rebuildBloom();
+            }
+        }
+    }
+
+    void clear() {
+        counts.clear();
+        keyBytes = 0;
+        bloomCapacity = 1024;
+        bloom.reset(bloomCapacity);
+        stats = DedupeStats();
+    }
+
+    DedupeStats getStats() const {
+        DedupeStats current = stats;
+        current.estimatedFalsePositiveRate = bloom.estimatedFalsePositiveRate();
+        current.bloomBytes = bloom.memoryBytes();
+        current.exactIndexBytes = exactIndexBytes();
+        return current;
+    }
+
+    size_t memoryBytes() const {
+        return bloom.memoryBytes() + exactIndexBytes();
+    }
+
+private:
+    size_t exactIndexBytes() const {
+        return keyBytes + counts.size() * (sizeof(string) + sizeof(size_t) + 2 * sizeof(void*)) +
+               counts.bucket_count() * sizeof(void*);
+    }
+
+    static uint64_t hashKey(const string& key) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    void rebuildBloom() {
+        bloomCapacity = max<size_t>(1024, counts.size() * 2);
+        bloom.reset(bloomCapacity);
+        for (const auto& entry : counts) {
+            bloom.insert(hashKey(entry.first));
+        }
+    }
+
+    BloomFilter bloom;
+    size_t bloomCapacity = 1024;
+    unordered_map<string, size_t> counts;
+    size_t keyBytes = 0;
+    DedupeStats stats;
+};
+
+uint64_t mixHash(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// The tasks as a near-duplicate scan saw them, shared by the scan and the report.
+struct DescriptionSnapshot {
+    vector<long long> ids;
+    vector<string> descriptions;
+};
+
+// Groups tasks whose descriptions are near-identical. Each description is reduced to a MinHash
+// signature over character 3-shingles of its normalized words; signatures are split into bands
+// and only tasks sharing a band bucket are compared, so the work stays far below all-pairs.
+// Candidates whose estimated Jaccard similarity reaches the threshold are joined with union-find.
+class NearDuplicateFinder {
+public:
+    explicit NearDuplicateFinder(double similarityThreshold = 0.6) : threshold(similarityThreshold) {
+        for (size_t h = 0; h < signatureSize; ++h) {
+            multipliers[h] = mixHash(h) | 1;
+            offsets[h] = mixHash(h + signatureSize);
+        }
+    }
+
+    vector<vector<size_t>> findClusters(const vector<string>& descriptions) const {
+        const size_t count = descriptions.size();
+        vector<uint64_t> signatures(count * signatureSize);
+
+        size_t workers = max<size_t>(1, min<size_t>(thread::hardware_concurrency(), count / minTasksPerWorker));
+        vector<thread> threads;
+        for (size_t w = 0; w < workers; ++w) {
+            threads.emplace_back([&, w]() {
+                for (size_t i = count * w / workers; i < count * (w + 1) / workers; ++i) {
+                    computeSignature(descriptions[i], &signatures[i * signatureSize]);
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        vector<size_t> parent(count);
+        for (size_t i = 0; i < count; ++i) {
+            parent[i] = i;
+        }
+        vector<pair<uint64_t, size_t>> buckets(count);
+        for (size_t band = 0; band < bands; ++band) {
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t key = band;
+                for (size_t row = 0; row < rowsPerBand; ++row) {
+                    key = mixHash(key ^ signatures[i * signatureSize + band * rowsPerBand + row]);
+                }
+                buckets[i] = make_pair(key, i);
+            }
+            sort(buckets.begin(), buckets.end());
+
+            // Compare each bucket member with the bucket's first member and its predecessor
+            // rather than with every other member, which keeps large buckets linear.
+            size_t first = 0;
+            for (size_t m = 1; m < count; ++m) {
+                if (buckets[m].first != buckets[first].first) {
+                    first = m;
+                    continue;
+                }
+                size_t a = buckets[first].second;
+                size_t b = buckets[m].second;
+                if (find(parent, a) == find(parent, b)) {
+                    continue;
+                }
+                if (similar(signatures, a, b)) {
+                    unite(parent, a, b);
+                } else if (m - 1 > first && similar(signatures, buckets[m - 1].second, b)) {
+                    unite(parent, buckets[m - 1].second, b);
+                }
+            }
+        }
+
+        map<size_t, vector<size_t>> groups;
+        for (size_t i = 0; i < count; ++i) {
+            groups[find(parent, i)].push_back(i);
+        }
+        vector<vector<size_t>> clusters;
+        for (auto& group : groups) {
+            if (group.second.size() > 1) {
+                clusters.push_back(move(group.second));
+            }
+        }
+        return clusters;
+    }
+
+private:
+    void computeSignature(const string& description, uint64_t* signature) const {
+        string normalized;
+        for (const string& word : splitWords(toLowerAscii(description))) {
+            normalized += normalized.empty() ? "" : " ";
+            normalized += word;
+        }
+        for (size_t h = 0; h < signatureSize; ++h) {
+            signature[h] = numeric_limits<uint64_t>::max();
+        }
+        size_t shingles = normalized.size() < shingleLength ? 1 : normalized.size() - shingleLength + 1;
+        for (size_t i = 0; i < shingles; ++i) {
+            uint64_t shingle = 0xcbf29ce484222325ULL;
+            for (size_t j = i; j < min(normalized.size(), i + shingleLength); ++j) {
+                shingle = (shingle ^ static_cast<unsigned char>(normalized[j])) * 0x100000001b3ULL;
+            }
+            shingle = mixHash(shingle);
+            for (size_t h = 0; h < signatureSize; ++h) {
+                // Cheap per-row permutations of one well-mixed shingle hash.
+                uint64_t permuted = shingle * multipliers[h] + offsets[h];
+                signature[h] = min(signature[h], permuted ^ (permuted >> 29));
+            }
+        }
+    }
+
+    bool similar(const vector<uint64_t>& signatures, size_t a, size_t b) const {
+        size_t agree = 0;
+        for (size_t h = 0; h < signatureSize; ++h) {
+            agree += signatures[a * signatureSize + h] == signatures[b * signatureSize + h] ? 1 : 0;
+        }
+        return static_cast<double>(agree) / signatureSize >= threshold;
+    }
+
+    static size_t find(vector<size_t>& parent, size_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    static void unite(vector<size_t>& parent, size_t a, size_t b) {
+        parent[find(parent, a)] = find(parent, b);
+    }
+
+    static const size_t shingleLength = 3;
+    static const size_t bands = 20;
+    static const size_t rowsPerBand = 3;
+    static const size_t signatureSize = bands * rowsPerBand;
+
+    double threshold;
+    array<uint64_t, signatureSize> multipliers;
+    array<uint64_t, signatureSize> offsets;
+};
+
+struct StatusCounts {
+    size_t pending = 0;
+    size_t completed = 0;
+};
+
+// Aggregates kept up to date by every mutation so the statistics view never scans the list.
+// Each add/remove touches the status totals, one due-week bucket and one entry per tag.
+class TaskStats {
+public:
+    void add(const Task& task) {
+        apply(task, 1);
+    }
+
+    void remove(const Task& task) {
+        apply(task, -1);
+    }
+
+    void display() const {
+        cout << "Statistics:" << endl;
+        cout << "  Pending: " << totals.pending << ", Completed: " << totals.completed << endl;
+        if (!byTag.empty()) {
+            cout << "  By tag:" << endl;
+            for (const auto& entry : byTag) {
+                cout << "    " << entry.first << ": " << entry.second.pending << " pending, " << entry.second.completed
+                     << " completed" << endl;
+            }
+        }
+        if (!byDueWeek.empty()) {
+            cout << "  By due week:" << endl;
+            for (const auto& entry : byDueWeek) {
+                cout << "    " << entry.first << ": " << entry.second.pending << " pending, " << entry.second.completed
+                     << " completed" << endl;
+            }
+        }
+    }
+
+    // Week buckets are labelled with the Monday that starts them.
+    static string dueWeekBucket(const string& dueDate) {
+        if (dueDate.empty()) {
+            return "No due date";
+        }
+        long long days;
+        if (!parseDate(dueDate, days)) {
+            return "Unrecognized date";
+        }
+        long long daysSinceMonday = ((days + 3) % 7 + 7) % 7; // 1970-01-01 was a Thursday
+        return "Week of " + civilFromDays(days - daysSinceMonday);
+    }
+
+    // Estimated from the group counts; group keys are short and mostly fit inline.
+    size_t memoryBytes() const {
+        return (byTag.size() + byDueWeek.size()) * (sizeof(pair<const string, StatusCounts>) + 4 * sizeof(void*));
+    }
+
+private:
+    static void adjust(StatusCounts& counts, bool completed, int delta) {
+        size_t& count = completed ? counts.completed : counts.pending;
+        count += delta;
+    }
+
+    template <typename Groups>
+    static void adjustGroup(Groups& groups, const string& key, bool completed, int delta) {
+        StatusCounts& counts = groups[key];
+        adjust(counts, completed, delta);
+        if (counts.pending == 0 && counts.completed == 0) {
+            groups.erase(key);
+        }
+    }
+
+    void apply(const Task& task, int delta) {
+        adjust(totals, task.isCompleted(), delta);
+        adjustGroup(byDueWeek, dueWeekBucket(task.getDueDate()), task.isCompleted(), delta);
+        for (const string& tag : task.getTags()) {
+            adjustGroup(byTag, tag, task.isCompleted(), delta);
+        }
+    }
+
+    StatusCounts totals;
+    map<string, StatusCounts> byTag;
+    map<string, StatusCounts> byDueWeek;
+};
+
+enum class TaskEventType { Created, Completed, Reopened, Deleted };
+
+struct TaskEvent {
+    long long timestamp;
+    TaskEventType type;
+    long long taskId;
+    long long leadTime; // Completed: seconds from creation to completion
+    int openDelta;      // Change in the number of open tasks caused by this event
+    shared_ptr<const Task> created = nullptr; // Created: the task as it was added
+};
+
+struct LeadTimeSummary {
+    size_t samples = 0;
+    long long p50 = 0;
+    long long p90 = 0;
+    long long p99 = 0;
+};
+
+// Append-only stream of task lifecycle events. Alongside the raw events it keeps per-hour
+// partial aggregates, so a window query only reads raw events for the partial hours at its
+// edges and sums whole hours from the aggregates, without replaying any task state.
+class EventLog {
+public:
+    void append(const TaskEvent& event) {
+        events.push_back(event);
+        Bucket& bucket = buckets[bucketStart(event.timestamp)];
+        bucket.openDelta += event.openDelta;
+        if (event.type == TaskEventType::Completed) {
+            ++bucket.completed;
+            bucket.leadTimes.push_back(event.leadTime);
+            payloadBytes += sizeof(long long);
+        }
+        if (event.created) {
+            payloadBytes += sizeof(Task) + event.created->heapBytes() + 2 * sizeof(void*);
+        }
+    }
+
+    // Events, the tasks recorded with creations, and the per-hour aggregates.
+    size_t memoryBytes() const {
+        return events.capacity() * sizeof(TaskEvent) + payloadBytes +
+               buckets.size() * (sizeof(pair<const long long, Bucket>) + 4 * sizeof(void*));
+    }
+
+    size_t throughput(long long from, long long to) const {
+        size_t completed = 0;
+        visitWindow(from, to, [&completed](const Bucket& bucket) { completed += bucket.completed; },
+                    [&completed](const TaskEvent& event) {
+                        completed += event.type == TaskEventType::Completed ? 1 : 0;
+                    });
+        return completed;
+    }
+
+    LeadTimeSummary leadTimes(long long from, long long to) const {
+        vector<long long> samples;
+        visitWindow(from, to,
+                    [&samples](const Bucket& bucket) {
+                        samples.insert(samples.end(), bucket.leadTimes.begin(), bucket.leadTimes.end());
+                    },
+                    [&samples](const TaskEvent& event) {
+                        if (event.type == TaskEventType::Completed) {
+                            samples.push_back(event.leadTime);
+                        }
+                    });
+        LeadTimeSummary summary;
+        summary.samples = samples.size();
+        if (!samples.empty()) {
+            summary.p50 = percentile(samples, 0.50);
+            summary.p90 = percentile(samples, 0.90);
+            summary.p99 = percentile(samples, 0.99);
+        }
+        return summary;
+    }
+
+    // Number of open tasks at from, from + step, ... up to and including to.
+    vector<long long> burndown(long long from, long long to, long long step) const {
+        vector<long long> points;
+        long long open = openDelta(numeric_limits<long long>::min(), from);
+        points.push_back(open);
+        for (long long t = from; t + step <= to; t += step) {
+            open += openDelta(t, t + step);
+            points.push_back(open);
+        }
+        return points;
+    }
+
+    const vector<TaskEvent>& getEvents() const {
+        return events;
+    }
+
+private:
+    struct Bucket {
+        size_t completed = 0;
+        long long openDelta = 0;
+        vector<long long> leadTimes;
+    };
+
+    static long long bucketStart(long long timestamp) {
+        return timestamp - ((timestamp % bucketSeconds) + bucketSeconds) % bucketSeconds;
+    }
+
+    long long openDelta(long long from, long long to) const {
+        long long delta = 0;
+        visitWindow(from, to, [&delta](const Bucket& bucket) { delta += bucket.openDelta; },
+                    [&delta](const TaskEvent& event) { delta += event.openDelta; });
+        return delta;
+    }
+
+    // Calls onBucket for every hour that lies entirely inside [from, to) and onEvent for the
+    // events in the partial hours at either end.
+    template <typename OnBucket, typename OnEvent>
+    void visitWindow(long long from, long long to, OnBucket onBucket, OnEvent onEvent) const {
+        if (from >= to || events.empty()) {
+            return;
+        }
+        long long fullFrom = from;
+        if (from > numeric_limits<long long>::min() && bucketStart(from) != from) {
+            fullFrom = bucketStart(from) + bucketSeconds;
+        }
+        long long fullTo = max(fullFrom, bucketStart(to));
+
+        if (fullFrom >= to) {
+            visitEvents(from, to, onEvent);
+            return;
+        }
+        visitEvents(from, fullFrom, onEvent);
+        for (auto it = buckets.lower_bound(fullFrom); it != buckets.end() && it->first < fullTo; ++it) {
+            onBucket(it->second);
+        }
+        visitEvents(fullTo, to, onEvent);
+    }
+
+    template <typename OnEvent>
+    void visitEvents(long long from, long long to, OnEvent onEvent) const {
+        auto byTime = [](const TaskEvent& event, long long timestamp) { return event.timestamp < timestamp; };
+        for (auto it = lower_bound(events.begin(), events.end(), from, byTime);
+             it != events.end() && it->timestamp < to; ++it) {
+            onEvent(*it);
+        }
+    }
+
+    static long long percentile(vector<long long>& samples, double fraction) {
+        size_t rank = static_cast<size_t>(fraction * (samples.size() - 1) + 0.5);
+        nth_element(samples.begin(), samples.begin() + rank, samples.end());
+        return samples[rank];
+    }
+
+    static const long long bucketSeconds = 3600;
+
+    vector<TaskEvent> events;
+    map<long long, Bucket> buckets;
+    size_t payloadBytes = 0;
+};
+
+// Materializes the task list as it was at a past moment. Every checkpointInterval events a
+// checkpoint of the list is kept, so a query replays at most that many events on top of the
+// newest checkpoint not after the requested time. Checkpoints share structure rather than copy
+// the list: the timeline keeps the list in creation order as chunks of task pointers, follows
+// each logged event, and a checkpoint holds only the chunk pointers. An event clones the chunk
+// it touches the first time it does so after a checkpoint, and a status change copies only its
+// task. Materialized lists are cached too, and a query may replay from a nearer one of those;
+// beyond maxCachedLists the one closest to its neighbours relative to its age goes, so the
+// cache thins out geometrically towards the past.
+class TaskTimeline {
+public:
+    explicit TaskTimeline(size_t interval = 4096) : checkpointInterval(interval) {
+        checkpoints.push_back(Checkpoint{0, {}});
+    }
+
+    // Follows the events appended to log since the last call. Call after every append; apart
+    // from a chunk clone, the work per event is constant, plus copying the chunk pointers once
+    // every checkpointInterval events.
+    void eventAppended(const EventLog& log) {
+        const vector<TaskEvent>& events = log.getEvents();
+        for (; appliedEvents < events.size(); ++appliedEvents) {
+            apply(events[appliedEvents]);
+            if ((appliedEvents + 1) % checkpointInterval == 0) {
+                checkpoints.push_back(Checkpoint{appliedEvents + 1, chunks});
+                chunkBytes += chunks.capacity() * sizeof(shared_ptr<Chunk>);
+            }
+        }
+    }
+
+    // Estimated bytes held by the chunks, the task copies in them, the checkpoints and the
+    // cached lists.
+    size_t memoryBytes() const {
+        return cachedBytes + chunkBytes + ordinals.size() * (sizeof(pair<const long long, size_t>) + 2 * sizeof(void*));
+    }
+
+    // Drops the cached lists and every checkpoint but the empty first one and the newest; queries
+    // before the newest then replay from the start until new checkpoints accumulate. Returns the
+    // bytes freed.
+    size_t evictCaches() {
+        size_t before = memoryBytes();
+        cache.clear();
+        cachedBytes = 0;
+        if (checkpoints.size() > 2) {
+            checkpoints.erase(checkpoints.begin() + 1, checkpoints.end() - 1);
+            checkpoints.shrink_to_fit();
+            recountChunkBytes();
+        }
+        return before - memoryBytes();
+    }
+
+    shared_ptr<const vector<Task>> asOf(const EventLog& log, long long timestamp) {
+        const vector<TaskEvent>& events = log.getEvents();
+        auto byTime = [](long long time, const TaskEvent& event) { return time < event.timestamp; };
+        size_t eventCount = upper_bound(events.begin(), events.end(), timestamp, byTime) - events.begin();
+
+        auto cachedByCount = [](size_t count, const CachedList& cached) { return count < cached.eventCount; };
+        auto nextCached = upper_bound(cache.begin(), cache.end(), eventCount, cachedByCount);
+        if (nextCached != cache.begin() && prev(nextCached)->eventCount == eventCount) {
+            return prev(nextCached)->tasks;
+        }
+        auto byCount = [](size_t count, const Checkpoint& checkpoint) { return count < checkpoint.eventCount; };
+        const Checkpoint& base = *(upper_bound(checkpoints.begin(), checkpoints.end(), eventCount, byCount) - 1);
+
+        shared_ptr<const vector<Task>> state;
+        if (nextCached != cache.begin() && prev(nextCached)->eventCount >= base.eventCount) {
+            const CachedList& nearer = *prev(nextCached);
+            state = replay(*nearer.tasks, events, nearer.eventCount, eventCount);
+        } else {
+            state = replay(materialize(base), events, base.eventCount, eventCount);
+        }
+        size_t bytes = snapshotBytes(*state);
+        cache.insert(nextCached, CachedList{eventCount, state, bytes});
+        cachedBytes += bytes;
+        if (cache.size() > maxCachedLists) {
+            dropCrowdedList(events.size());
+        }
+        return state;
+    }
+
+private:
+    typedef vector<shared_ptr<const Task>> Chunk; // Null where the task was deleted
+
+    struct Checkpoint {
+        size_t eventCount;
+        vector<shared_ptr<Chunk>> chunks;
+    };
+
+    struct CachedList {
+        size_t eventCount;
+        shared_ptr<const vector<Task>> tasks;
+        size_t bytes;
+    };
+
+    void apply(const TaskEvent& event) {
+        if (event.type == TaskEventType::Created) {
+            if (!event.created) {
+                return;
+            }
+            if (created % chunkSize == 0) {
+                chunks.push_back(make_shared<Chunk>());
+                chunks.back()->reserve(chunkSize);
+                chunkBytes += chunkSize * sizeof(shared_ptr<const Task>);
+            }
+            writableChunk(created / chunkSize).push_back(event.created);
+            ordinals[event.taskId] = created++;
+            return;
+        }
+        auto found = ordinals.find(event.taskId);
+        if (found == ordinals.end()) {
+            return;
+        }
+        shared_ptr<const Task>& entry = writableChunk(found->second / chunkSize)[found->second % chunkSize];
+        shared_ptr<const Task> previous = move(entry);
+        if (event.type == TaskEventType::Deleted) {
+            ordinals.erase(found);
+        } else {
+            auto task = make_shared<Task>(*previous);
+            if (event.type == TaskEventType::Completed) {
+                task->markCompleted(event.timestamp);
+            } else {
+                task->markPending();
+            }
+            chunkBytes += sizeof(Task) + task->heapBytes();
+            entry = task;
+        }
+        if (previous.use_count() == 1) {
+            chunkBytes -= sizeof(Task) + previous->heapBytes(); // A copy no checkpoint or event holds
+        }
+    }
+
+    // The chunk, cloned first if a checkpoint shares it.
+    Chunk& writableChunk(size_t index) {
+        if (chunks[index].use_count() > 1) {
+            auto clone = make_shared<Chunk>();
+            clone->reserve(chunkSize);
+            clone->assign(chunks[index]->begin(), chunks[index]->end());
+            chunks[index] = clone;
+            chunkBytes += chunkSize * sizeof(shared_ptr<const Task>);
+        }
+        return *chunks[index];
+    }
+
+    // Counts every chunk and every task copy still reachable once, after checkpoints are dropped.
+    // A task whose references all come from chunks is a copy the timeline made.
+    void recountChunkBytes() {
+        unordered_set<const Chunk*> seenChunks;
+        unordered_map<const Task*, long> references;
+        chunkBytes = 0;
+        auto count = [&](const vector<shared_ptr<Chunk>>& list) {
+            chunkBytes += list.capacity() * sizeof(shared_ptr<Chunk>);
+            for (const auto& chunk : list) {
+                if (!seenChunks.insert(chunk.get()).second) {
+                    continue;
+                }
+                chunkBytes += chunkSize * sizeof(shared_ptr<const Task>);
+                for (const auto& task : *chunk) {
+                    if (task) {
+                        ++references[task.get()];
+                    }
+                }
+            }
+        };
+        count(chunks);
+        for (const Checkpoint& checkpoint : checkpoints) {
+            count(checkpoint.chunks);
+        }
+        for (const auto& chunk : seenChunks) {
+            for (const auto& task : *chunk) {
+                auto found = task ? references.find(task.get()) : references.end();
+                if (found != references.end() && task.use_count() == found->second) {
+                    chunkBytes += sizeof(Task) + task->heapBytes();
+                    references.erase(found);
+                }
+            }
+        }
+    }
+
+    static vector<Task> materialize(const Checkpoint& checkpoint) {
+        vector<Task> tasks;
+        for (const auto& chunk : checkpoint.chunks) {
+            for (const auto& task : *chunk) {
+                if (task) {
+                    tasks.push_back(*task);
+                }
+            }
+        }
+        return tasks;
+    }
+
+    // Removes the cached list whose neighbours are closest together for how far back it lies.
+    void dropCrowdedList(size_t totalEvents) {
+        auto victim = cache.begin();
+        double crowding = numeric_limits<double>::max();
+        for (auto it = cache.begin(); it != cache.end(); ++it) {
+            size_t preceding = it == cache.begin() ? 0 : prev(it)->eventCount;
+            size_t following = next(it) == cache.end() ? totalEvents : next(it)->eventCount;
+            double span = static_cast<double>(following - preceding);
+            double age = static_cast<double>(totalEvents - preceding + 1);
+            if (span / age < crowding) {
+                crowding = span / age;
+                victim = it;
+            }
+        }
+        cachedBytes -= victim->bytes;
+        cache.erase(victim);
+    }
+
+    static size_t snapshotBytes(const vector<Task>& tasks) {
+        size_t bytes = tasks.capacity() * sizeof(Task);
+        for (const Task& task : tasks) {
+            bytes += task.heapBytes();
+        }
+        return bytes;
+    }
+
+    static shared_ptr<const vector<Task>> replay(vector<Task> tasks, const vector<TaskEvent>& events, size_t begin,
+                                                 size_t end) {
+        // Only the tasks the events name need their slots, so the base is scanned once rather
+        // than hashed whole.
+        unordered_map<long long, size_t> slotById;
+        for (size_t e = begin; e < end; ++e) {
+            if (events[e].type != TaskEventType::Created) {
+                slotById.emplace(events[e].taskId, numeric_limits<size_t>::max());
+            }
+        }
+        for (size_t i = 0; i < tasks.size() && !slotById.empty(); ++i) {
+            auto found = slotById.find(tasks[i].getId());
+            if (found != slotById.end()) {
+                found->second = i;
+            }
+        }
+        vector<bool> removed(tasks.size(), false);
+
+        for (size_t e = begin; e < end; ++e) {
+            const TaskEvent& event = events[e];
+            if (event.type == TaskEventType::Created) {
+                if (!event.created) {
+                    continue;
+                }
+                slotById[event.taskId] = tasks.size();
+                tasks.push_back(*event.created);
+                removed.push_back(false);
+                continue;
+            }
+            auto found = slotById.find(event.taskId);
+            if (found == slotById.end() || found->second == numeric_limits<size_t>::max()) {
+                continue;
+            }
+            Task& task = tasks[found->second];
+            if (event.type == TaskEventType::Completed) {
+                task.markCompleted(event.timestamp);
+            } else if (event.type == TaskEventType::Reopened) {
+                task.markPending();
+            } else {
+                removed[found->second] = true;
+                found->second = numeric_limits<size_t>::max();
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            if (!removed[i]) {
+                if (kept != i) {
+                    tasks[kept] = move(tasks[i]);
+                }
+                ++kept;
+            }
+        }
+        tasks.erase(tasks.begin() + kept, tasks.end());
+        return make_shared<const vector<Task>>(move(tasks));
+    }
+
+    static const size_t chunkSize = 256;
+    static const size_t maxCachedLists = 8;
+
+    size_t checkpointInterval;
+    vector<shared_ptr<Chunk>> chunks;          // The list after appliedEvents events, by creation order
+    unordered_map<long long, size_t> ordinals; // Task ID -> position in chunks, for tasks not deleted
+    size_t created = 0;                        // Positions used in chunks
+    size_t appliedEvents = 0;
+    vector<Checkpoint> checkpoints; // By event count, the first one empty
+    list<CachedList> cache;         // By event count
+    size_t chunkBytes = 0;
+    size_t cachedBytes = 0;
+};
+
+// Parent/child links between tasks with per-subtree totals. Every node stores the size and the
+// number of completed tasks in its subtree, so "percent complete" is O(1); adding, removing or
+// changing the status of a task adjusts only its ancestors. Children whose parent is not in the
+// tree (for example while a deleted subtree is being restored) wait until the parent returns.
+class TaskTree {
+public:
+    void add(const Task& task) {
+        Node node;
+        node.parent = task.getParentId();
+        node.completed = task.isCompleted() ? 1 : 0;
+        auto waitingChildren = waiting.find(task.getId());
+        if (waitingChildren != waiting.end()) {
+            for (long long child : waitingChildren->second) {
+                node.children.push_back(child);
+                node.size += nodes[child].size;
+                node.completed += nodes[child].completed;
+            }
+            waiting.erase(waitingChildren);
+        }
+        size_t size = node.size;
+        size_t completed = node.completed;
+        nodes[task.getId()] = move(node);
+
+        long long parent = task.getParentId();
+        if (parent == 0) {
+            return;
+        }
+        if (nodes.count(parent) == 0) {
+            waiting[parent].push_back(task.getId());
+            return;
+        }
+        nodes[parent].children.push_back(task.getId());
+        adjustAncestors(parent, static_cast<long long>(size), static_cast<long long>(completed));
+    }
+
+    void remove(const Task& task) {
+        auto found = nodes.find(task.getId());
+        if (found == nodes.end()) {
+            return;
+        }
+        Node node = move(found->second);
+        nodes.erase(found);
+
+        if (node.parent != 0) {
+            auto parent = nodes.find(node.parent);
+            vector<long long>& siblings = parent != nodes.end() ? parent->second.children : waiting[node.parent];
+            auto sibling = find(siblings.begin(), siblings.end(), task.getId());
+            if (sibling != siblings.end()) {
+                siblings.erase(sibling);
+            }
+            if (parent != nodes.end()) {
+                adjustAncestors(node.parent, -static_cast<long long>(node.size), -static_cast<long long>(node.completed));
+            } else if (siblings.empty()) {
+                waiting.erase(node.parent);
+            }
+        }
+        if (!node.children.empty()) {
+            waiting[task.getId()] = move(node.children);
+        }
+    }
+
+    // The task followed by all of its descendants, depth first.
+    vector<long long> subtree(long long id) const {
+        vector<long long> result;
+        vector<long long> pending{id};
+        while (!pending.empty()) {
+            long long current = pending.back();
+            pending.pop_back();
+            auto node = nodes.find(current);
+            if (node == nodes.end()) {
+                continue;
+            }
+            result.push_back(current);
+            pending.insert(pending.end(), node->second.children.rbegin(), node->second.children.rend());
+        }
+        return result;
+    }
+
+    void statusChanged(const Task& task) {
+        adjustAncestors(task.getId(), 0, task.isCompleted() ? 1 : -1);
+    }
+
+    size_t subtreeSize(long long id) const {
+        auto node = nodes.find(id);
+        return node == nodes.end() ? 0 : node->second.size;
+    }
+
+    size_t subtreeCompleted(long long id) const {
+        auto node = nodes.find(id);
+        return node == nodes.end() ? 0 : node->second.completed;
+    }
+
+    // Estimated; every task appears once as a node and at most once in a list of children.
+    size_t memoryBytes() const {
+        const size_t nodeEntry = sizeof(pair<const long long, Node>) + 2 * sizeof(void*) + sizeof(long long);
+        return (nodes.size() + waiting.size()) * nodeEntry + (nodes.bucket_count() + waiting.bucket_count()) * sizeof(void*);
+    }
+
+    size_t depth(long long id) const {
+        size_t levels = 0;
+        for (auto node = nodes.find(id); node != nodes.end() && node->second.parent != 0; node = nodes.find(node->second.parent)) {
+            ++levels;
+        }
+        return levels;
+    }
+
+private:
+    struct Node {
+        long long parent = 0;
+        vector<long long> children;
+        size_t size = 1;
+        size_t completed = 0;
+    };
+
+    void adjustAncestors(long long id, long long sizeDelta, long long completedDelta) {
+        for (auto node = nodes.find(id); node != nodes.end(); node = nodes.find(node->second.parent)) {
+            node->second.size += sizeDelta;
+            node->second.completed += completedDelta;
+            if (node->second.parent == 0) {
+                break;
+            }
+        }
+    }
+
+    unordered_map<long long, Node> nodes;
+    unordered_map<long long, vector<long long>> waiting; // Missing parent ID -> its children
+};
+
+class Sha256 {
+public:
+    Sha256() {
+        state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    }
+
+    void update(const char* data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            block[blockUsed++] = static_cast<unsigned char>(data[i]);
+            if (blockUsed == 64) {
+                compress();
+                blockUsed = 0;
+            }
+        }
+        totalBytes += size;
+    }
+
+    string hexDigest() {
+        uint64_t bitLength = totalBytes * 8;
+        char padding = static_cast<char>(0x80);
+        update(&padding, 1);
+        char zero = 0;
+        while (blockUsed != 56) {
+            update(&zero, 1);
+        }
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            char byte = static_cast<char>(bitLength >> shift);
+            update(&byte, 1);
+        }
+        static const char* digits = "0123456789abcdef";
+        string hex;
+        for (uint32_t word : state) {
+            for (int shift = 28; shift >= 0; shift -= 4) {
+                hex += digits[(word >> shift) & 0xf];
+            }
+        }
+        return hex;
+    }
+
+    static string hash(const string& data) {
+        Sha256 sha;
+        sha.update(data.data(), data.size());
+        return sha.hexDigest();
+    }
+
+private:
+    static uint32_t rotate(uint32_t value, int bits) {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    void compress() {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
+            0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+            0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+            0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
+            0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+            0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = static_cast<uint32_t>(block[4 * i]) << 24 | static_cast<uint32_t>(block[4 * i + 1]) << 16 |
+                   static_cast<uint32_t>(block[4 * i + 2]) << 8 | static_cast<uint32_t>(block[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        array<uint32_t, 8> v = state;
+        for (int i = 0; i < 64; ++i) {
+            uint32_t s1 = rotate(v[4], 6) ^ rotate(v[4], 11) ^ rotate(v[4], 25);
+            uint32_t choose = (v[4] & v[5]) ^ (~v[4] & v[6]);
+            uint32_t t1 = v[7] + s1 + choose + k[i] + w[i];
+            uint32_t s0 = rotate(v[0], 2) ^ rotate(v[0], 13) ^ rotate(v[0], 22);
+            uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+            uint32_t t2 = s0 + majority;
+            v = {t1 + t2, v[0], v[1], v[2], v[3] + t1, v[4], v[5], v[6]};
+        }
+        for (int i = 0; i < 8; ++i) {
+            state[i] += v[i];
+        }
+    }
+
+    array<uint32_t, 8> state;
+    unsigned char block[64];
+    size_t blockUsed = 0;
+    uint64_t totalBytes = 0;
+};
+
+// A read-only view of a stored blob. Chunks are memory-mapped only when a read first touches
+// them, so opening a large attachment costs nothing until its bytes are needed.
+class MappedBlob {
+public:
+    MappedBlob(const string& chunkDirectory, const vector<pair<string, size_t>>& blobChunks)
+        : directory(chunkDirectory), chunks(blobChunks), mappings(blobChunks.size(), nullptr) {
+        for (const auto& chunk : chunks) {
+            totalSize += chunk.second;
+        }
+    }
+
+    MappedBlob(const MappedBlob&) = delete;
+    MappedBlob& operator=(const MappedBlob&) = delete;
+
+    ~MappedBlob() {
+        for (size_t i = 0; i < mappings.size(); ++i) {
+#if defined(__unix__) || defined(__APPLE__)
+            if (mappings[i] != nullptr && chunks[i].second > 0) {
+                munmap(const_cast<char*>(mappings[i]), chunks[i].second);
+            }
+#else
+            delete[] mappings[i];
+#endif
+        }
+    }
+
+    size_t size() const {
+        return totalSize;
+    }
+
+    // Calls consume(data, length) for consecutive pieces of the blob; stops early on false.
+    template <typename Consume>
+    bool forEachPiece(Consume consume) {
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            const char* data = map(i);
+            if (data == nullptr && chunks[i].second > 0) {
+                return false;
+            }
+            if (!consume(data, chunks[i].second)) {
+                break;
+            }
+        }
+        return true;
+    }
+
+private:
+    const char* map(size_t index) {
+        if (mappings[index] != nullptr || chunks[index].second == 0) {
+            return mappings[index];
+        }
+        string path = directory + "/" + chunks[index].first;
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        void* mapped = mmap(nullptr, chunks[index].second, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        mappings[index] = mapped == MAP_FAILED ? nullptr : static_cast<const char*>(mapped);
+#else
+        ifstream in(path, ios::binary);
+        char* buffer = new char[chunks[index].second];
+        if (!in.read(buffer, chunks[index].second)) {
+            delete[] buffer;
+            return nullptr;
+        }
+        mappings[index] = buffer;
+#endif
+        return mappings[index];
+    }
+
+    string directory;
+    vector<pair<string, size_t>> chunks; // (chunk hash, length)
+    vector<const char*> mappings;
+    size_t totalSize = 0;
+};
+
+// Content-addressed storage for notes and attachments, kept out of the task records. Content is
+// split into chunks at content-defined boundaries (a gear rolling hash), so an edit only changes
+// the chunks around it. Each chunk is stored once under its SHA-256; a blob is a small manifest
+// listing its chunks and is itself named by the SHA-256 of that manifest.
+class BlobStore {
+public:
+    explicit BlobStore(const string& rootDirectory = "todo.blobs") : root(rootDirectory) {
+        for (size_t i = 0; i < gear.size(); ++i) {
+            gear[i] = mixHash(i);
+        }
+    }
+
+    // Returns the blob ID, or an empty string if the content could not be stored.
+    string put(istream& in, uint64_t& size) {
+        size = 0;
+        error_code error;
+        filesystem::create_directories(root + "/chunks", error);
+        filesystem::create_directories(root + "/blobs", error);
+        if (error) {
+            return string();
+        }
+
+        string manifest;
+        string chunk;
+        uint64_t rolling = 0;
+        char buffer[1 << 16];
+        while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+            streamsize count = in.gcount();
+            size += count;
+            for (streamsize i = 0; i < count; ++i) {
+                chunk += buffer[i];
+                rolling = (rolling << 1) + gear[static_cast<unsigned char>(buffer[i])];
+                if ((chunk.size() >= minChunk && (rolling & boundaryMask) == 0) || chunk.size() >= maxChunk) {
+                    if (!storeChunk(chunk, manifest)) {
+                        return string();
+                    }
+                    chunk.clear();
+                    rolling = 0;
+                }
+            }
+        }
+        if (!chunk.empty() && !storeChunk(chunk, manifest)) {
+            return string();
+        }
+
+        string id = Sha256::hash(manifest);
+        string manifestPath = root + "/blobs/" + id;
+        if (!filesystem::exists(manifestPath) && !writeFileAtomically(manifestPath, manifest)) {
+            return string();
+        }
+        return id;
+    }
+
+    unique_ptr<MappedBlob> open(const string& id) const {
+        string manifest;
+        if (!readFile(root + "/blobs/" + id, manifest)) {
+            return nullptr;
+        }
+        vector<pair<string, size_t>> chunks;
+        istringstream lines(manifest);
+        string hash;
+        size_t length;
+        while (lines >> hash >> length) {
+            chunks.emplace_back(hash, length);
+        }
+        return unique_ptr<MappedBlob>(new MappedBlob(root + "/chunks", chunks));
+    }
+
+private:
+    bool storeChunk(const string& chunk, string& manifest) {
+        string hash = Sha256::hash(chunk);
+        string path = root + "/chunks/" + hash;
+        if (!filesystem::exists(path) && !writeFileAtomically(path, chunk)) {
+            return false;
+        }
+        manifest += hash + " " + to_string(chunk.size()) + "\n";
+        return true;
+    }
+
+    static const size_t minChunk = 16 * 1024;
+    static const size_t maxChunk = 256 * 1024;
+    static const uint64_t boundaryMask = (1 << 16) - 1; // About 64 KiB between boundaries on average
+
+    string root;
+    array<uint64_t, 256> gear;
+};
+
+enum class OperationPhase { Lookup, Mutate, IndexUpdate, Persist };
+
+// One entry in the slow-operation log. Plain data of a fixed size, so it can be copied through
+// the log's atomic words.
+struct SlowOperation {
+    char name[24];
+    char arguments[48];
+    uint64_t timestamp; // Milliseconds since the epoch
+    uint64_t threadId;
+    uint64_t listSize;
+    uint64_t historyDepth;
+    uint64_t totalNanos;
+    uint64_t phaseNanos[4]; // Indexed by OperationPhase
+};
+
+// Ring buffer of the most recent slow operations. Writers claim a slot with one fetch_add and
+// never wait; each slot carries a sequence number that is odd while it is being written, so a
+// reader skips entries that are torn or were overwritten while it copied them.
+class SlowOpLog {
+public:
+    static const size_t capacity = 256;
+
+    void setThreshold(chrono::nanoseconds threshold) {
+        thresholdNanos.store(threshold.count(), memory_order_relaxed);
+    }
+
+    chrono::nanoseconds getThreshold() const {
+        return chrono::nanoseconds(thresholdNanos.load(memory_order_relaxed));
+    }
+
+    void record(const SlowOperation& operation) {
+        uint64_t ticket = next.fetch_add(1, memory_order_relaxed);
+        Slot& slot = slots[ticket % capacity];
+        slot.sequence.store(2 * ticket + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        uint64_t words[wordCount];
+        memcpy(words, &operation, sizeof(operation));
+        for (size_t i = 0; i < wordCount; ++i) {
+            slot.words[i].store(words[i], memory_order_relaxed);
+        }
+        slot.sequence.store(2 * ticket + 2, memory_order_release);
+    }
+
+    // The entries still in the buffer, oldest first.
+    vector<SlowOperation> snapshot() const {
+        vector<SlowOperation> operations;
+        uint64_t end = next.load(memory_order_acquire);
+        for (uint64_t ticket = end > capacity ? end - capacity : 0; ticket < end; ++ticket) {
+            const Slot& slot = slots[ticket % capacity];
+            if (slot.sequence.load(memory_order_acquire) != 2 * ticket + 2) {
+                continue;
+            }
+            uint64_t words[wordCount];
+            for (size_t i = 0; i < wordCount; ++i) {
+                words[i] = slot.words[i].load(memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+            if (slot.sequence.load(memory_order_relaxed) != 2 * ticket + 2) {
+                continue;
+            }
+            SlowOperation operation;
+            memcpy(&operation, words, sizeof(operation));
+            operations.push_back(operation);
+        }
+        return operations;
+    }
+
+    void display() const {
+        vector<SlowOperation> operations = snapshot();
+        cout << "Operations slower than " << getThreshold().count() / 1000 << " us: " << operations.size() << endl;
+        static const char* phaseNames[] = {"lookup", "mutate", "index", "persist"};
+        for (const SlowOperation& operation : operations) {
+            cout << "  " << operation.name << "(" << operation.arguments << ") " << operation.totalNanos / 1000 << " us";
+            for (size_t phase = 0; phase < 4; ++phase) {
+                if (operation.phaseNanos[phase] > 0) {
+                    cout << ", " << phaseNames[phase] << " " << operation.phaseNanos[phase] / 1000 << " us";
+                }
+            }
+            cout << "; " << operation.listSize << " tasks, history depth " << operation.historyDepth << ", thread "
+                 << hex << operation.threadId << dec << ", at " << operation.timestamp << endl;
+        }
+    }
+
+private:
+    static_assert(sizeof(SlowOperation) % sizeof(uint64_t) == 0, "SlowOperation must be a whole number of words");
+    static const size_t wordCount = sizeof(SlowOperation) / sizeof(uint64_t);
+
+    struct Slot {
+        atomic<uint64_t> sequence{0};
+        atomic<uint64_t> words[wordCount];
+    };
+
+    array<Slot, capacity> slots;
+    atomic<uint64_t> next{0};
+    atomic<long long> thresholdNanos{1000000};
+};
+
+// Times one manager operation phase by phase and records it in the slow-operation log when the
+// whole operation took longer than the log's threshold. Time not attributed to a phase with
+// endPhase still counts toward the total. Also fires the todo:operation__start and
+// todo:operation__done tracepoints; done carries (name, task ID, list size, detail, nanoseconds),
+// where detail is the match count of a query or the bytes written by a save. The arguments are
+// only referenced, so they must outlive the timer; they are copied when an entry is recorded.
+class OperationTimer {
+public:
+    OperationTimer(SlowOpLog& log, const char* name, const string& arguments, const vector<Task>& tasks,
+                   const TaskHistory& history)
+        : log(log), name(name), arguments(arguments.c_str()), tasks(tasks), history(history),
+          started(chrono::steady_clock::now()), phaseStarted(started) {
+        TODO_PROBE2(operation__start, name, this->arguments);
+    }
+
+    // For operations whose argument is a number, such as a slot or a step count.
+    OperationTimer(SlowOpLog& log, const char* name, long long argument, const vector<Task>& tasks,
+                   const TaskHistory& history)
+        : log(log), name(name), arguments(numberText), tasks(tasks), history(history), started(chrono::steady_clock::now()),
+          phaseStarted(started) {
+        snprintf(numberText, sizeof(numberText), "%lld", argument);
+        TODO_PROBE2(operation__start, name, this->arguments);
+    }
+
+    OperationTimer(const OperationTimer&) = delete;
+    OperationTimer& operator=(const OperationTimer&) = delete;
+
+    void setTaskId(long long id) {
+        taskId = id;
+    }
+
+    void setDetail(uint64_t value) {
+        detail = value;
+    }
+
+    void endPhase(OperationPhase phase) {
+        auto now = chrono::steady_clock::now();
+        phaseNanos[static_cast<size_t>(phase)] += chrono::duration_cast<chrono::nanoseconds>(now - phaseStarted).count();
+        phaseStarted = now;
+    }
+
+    ~OperationTimer() {
+        auto total = chrono::steady_clock::now() - started;
+        TODO_PROBE5(operation__done, name, taskId, tasks.size(), detail,
+                    static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(total).count()));
+        if (total < log.getThreshold()) {
+            return;
+        }
+        SlowOperation operation;
+        memset(&operation, 0, sizeof(operation));
+        strncpy(operation.name, name, sizeof(operation.name) - 1);
+        strncpy(operation.arguments, arguments, sizeof(operation.arguments) - 1);
+        operation.timestamp = static_cast<uint64_t>(currentTimeMillis());
+        operation.threadId = hash<thread::id>()(this_thread::get_id());
+        operation.listSize = tasks.size();
+        operation.historyDepth = history.depth();
+        operation.totalNanos = chrono::duration_cast<chrono::nanoseconds>(total).count();
+        copy(begin(phaseNanos), end(phaseNanos), operation.phaseNanos);
+        log.record(operation);
+    }
+
+private:
+    SlowOpLog& log;
+    const char* name;
+    const char* arguments;
+    char numberText[24];
+    const vector<Task>& tasks;
+    const TaskHistory& history;
+    chrono::steady_clock::time_point started;
+    chrono::steady_clock::time_point phaseStarted;
+    uint64_t phaseNanos[4] = {0, 0, 0, 0};
+    long long taskId = 0;
+    uint64_t detail = 0;
+};
+
+// Rules for purging completed tasks; a zero field disables that rule.
+struct RetentionPolicy {
+    long long maxCompletedAgeDays = 0;
+    size_t maxCompletedKept = 0;
+};
+
+// Progress of one retention pass, so it can be carried out a slice at a time.
+struct RetentionSweep {
+    RetentionPolicy policy;
+    bool collected = false;
+    size_t scanned = 0;
+    vector<pair<long long, long long>> completed; // (completedAt, id); after collection, only those to purge
+    size_t purged = 0;
+};
+
+// Estimated bytes held by one list, by kind.
+struct MemoryUsage {
+    size_t tasks = 0;   // Task records and the strings they own
+    size_t history = 0; // Undo and redo entries in memory
+    size_t indexes = 0; // Fuzzy, duplicate, statistics and subtask indexes
+    size_t events = 0;  // Event log behind analytics and the timeline
+    size_t caches = 0;  // Slot cache and timeline snapshots
+
+    size_t total() const {
+        return tasks + history + indexes + events + caches;
+    }
+};
+
+// What a list has given up to stay within its memory budget.
+struct MemoryEvictions {
+    size_t historyTrims = 0;
+    size_t historyEntriesDropped = 0;
+    size_t cacheEvictions = 0;
+    size_t indexEvictions = 0;
+    size_t indexRebuilds = 0;
+    size_t rejectedWrites = 0;
+    string lastAction;
+};
+
+class ToDoListManager {
+public:
+    ToDoListManager() = default;
+    ToDoListManager(const ToDoListManager&) = delete;
+    ToDoListManager& operator=(const ToDoListManager&) = delete;
+
+    ~ToDoListManager() {
+        stopRetention();
+    }
+
+    // Held by the foreground while it runs a command; the retention worker takes it only for
+    // one small batch at a time.
+    unique_lock<mutex> lockForCommand() {
+        return unique_lock<mutex>(stateMutex);
+    }
+
+    bool addTask(const Task& task) {
+        OperationTimer timer(slowOps, "addTask", task.getDescription(), tasks, history);
+        if (!admitWrite()) {
+            return false;
+        }
+        if (dedupeEnabled && duplicates.isDuplicate(task)) {
+            return false;
+        }
+        timer.endPhase(OperationPhase::Lookup);
+        tasks.push_back(task);
+        tasks.back().assignId(nextTaskId++);
+        cacheLastSlot();
+        timer.setTaskId(tasks.back().getId());
+        recordChange(TaskMemento::absent(tasks.back().getId(), tasks.size() - 1));
+        timer.endPhase(OperationPhase::Mutate);
+        indexTask(tasks.back());
+        logEvent(TaskEvent{currentTimestamp(), TaskEventType::Created, tasks.back().getId(), 0, task.isCompleted() ? 0 : 1,
+                           make_shared<const Task>(tasks.back())});
+        timer.endPhase(OperationPhase::IndexUpdate);
+        return true;
+    }
+
+    void setDedupeEnabled(bool enabled) {
+        if (enabled && !dedupeEnabled) {
+            duplicates.clear();
+            for (const auto& task : tasks) {
+                duplicates.add(task);
+            }
+        }
+        dedupeEnabled = enabled;
+    }
+
+    bool isDedupeEnabled() const {
+        return dedupeEnabled;
+    }
+
+    void showDedupeStats() const {
+        DedupeStats stats = duplicates.getStats();
+        cout << "Duplicate detection: " << (dedupeEnabled ? "on" : "off") << endl;
+        cout << "  Checks: " << stats.checks << ", rejected: " << stats.duplicatesRejected << endl;
+        cout << "  Bloom negatives: " << stats.bloomNegatives << ", false positives: " << stats.bloomFalsePositives;
+        size_t nonDuplicates = stats.checks - stats.duplicatesRejected;
+        if (nonDuplicates > 0) {
+            cout << " (observed rate " << static_cast<double>(stats.bloomFalsePositives) / nonDuplicates << ")";
+        }
+        cout << endl;
+        cout << "  Estimated false-positive rate: " << stats.estimatedFalsePositiveRate << endl;
+        cout << "  Memory: " << stats.bloomBytes << " bytes Bloom filter, ~" << stats.exactIndexBytes
+             << " bytes exact index" << endl;
+    }
+
+    void markTaskCompleted(int index) {
+        OperationTimer timer(slowOps, "markTaskCompleted", index, tasks, history);
+        if (index >= 0 && index < tasks.size() && !tasks[index].isCompleted()) {
+            timer.setTaskId(tasks[index].getId());
+            recordChange(snapshotOf(index));
+            long long now = currentTimestamp();
+            stats.remove(tasks[index]);
+            tasks[index].markCompleted(now);
+            timer.endPhase(OperationPhase::Mutate);
+            stats.add(tasks[index]);
+            tree.statusChanged(tasks[index]);
+            ++generation;
+            logStatusChange(tasks[index], now);
+            timer.endPhase(OperationPhase::IndexUpdate);
+        }
+    }
+
+    void markTaskPending(int index) {
+        OperationTimer timer(slowOps, "markTaskPending", index, tasks, history);
+        if (index >= 0 && index < tasks.size() && tasks[index].isCompleted()) {
+            timer.setTaskId(tasks[index].getId());
+            recordChange(snapshotOf(index));
+            stats.remove(tasks[index]);
+            tasks[index].markPending();
+            timer.endPhase(OperationPhase::Mutate);
+            stats.add(tasks[index]);
+            tree.statusChanged(tasks[index]);
+            ++generation;
+            logStatusChange(tasks[index], currentTimestamp());
+            timer.endPhase(OperationPhase::IndexUpdate);
+        }
+    }
+
+    bool addSubtask(int parentIndex, Task task) {
+        if (parentIndex < 0 || parentIndex >= static_cast<int>(tasks.size())) {
+            return false;
+        }
+        task.assignParent(tasks[parentIndex].getId());
+        return addTask(task);
+    }
+
+    // Deletes the task together with all of its subtasks as a single undo step.
+    void deleteTask(int index) {
+        OperationTimer timer(slowOps, "deleteTask", index, tasks, history);
+        if (index >= 0 && index < tasks.size()) {
+            timer.setTaskId(tasks[index].getId());
+            vector<size_t> slots;
+            for (long long id : tree.subtree(tasks[index].getId())) {
+                slots.push_back(static_cast<size_t>(findSlot(id)));
+            }
+            timer.endPhase(OperationPhase::Lookup);
+            deleteSlots(slots, timer);
+        }
+    }
+
+    void viewSubtree(int index) const {
+        if (index < 0 || index >= static_cast<int>(tasks.size())) {
+            cout << "Invalid task index." << endl;
+            return;
+        }
+        long long rootId = tasks[index].getId();
+        size_t rootDepth = tree.depth(rootId);
+        for (long long id : tree.subtree(rootId)) {
+            int slot = findSlot(id);
+            size_t size = tree.subtreeSize(id);
+            cout << string(2 * (tree.depth(id) - rootDepth), ' ');
+            if (size > 1) {
+                cout << "[" << (100 * tree.subtreeCompleted(id) / size) << "% of " << size << "] ";
+            }
+            tasks[slot].display(slot);
+        }
+    }
+
+    bool attachToTask(int index, istream& content, const string& name, bool isNote) {
+        if (index < 0 || index >= static_cast<int>(tasks.size()) || !admitWrite()) {
+            return false;
+        }
+        Attachment attachment;
+        attachment.name = name;
+        attachment.isNote = isNote;
+        attachment.blobId = blobs.put(content, attachment.size);
+        if (attachment.blobId.empty()) {
+            return false;
+        }
+        recordChange(snapshotOf(index));
+        taskHeapBytes -= tasks[index].heapBytes();
+        tasks[index].addAttachment(attachment);
+        taskHeapBytes += tasks[index].heapBytes();
+        return true;
+    }
+
+    // Notes are printed in full; files are listed with their size and blob ID.
+    void viewAttachments(int index) const {
+        if (index < 0 || index >= static_cast<int>(tasks.size())) {
+            cout << "Invalid task index." << endl;
+            return;
+        }
+        const vector<Attachment>& attachments = tasks[index].getAttachments();
+        if (attachments.empty()) {
+            cout << "No attachments." << endl;
+            return;
+        }
+        for (size_t i = 0; i < attachments.size(); ++i) {
+            const Attachment& attachment = attachments[i];
+            cout << i + 1 << ". " << (attachment.isNote ? "Note" : attachment.name) << " (" << attachment.size << " bytes)";
+            unique_ptr<MappedBlob> blob = blobs.open(attachment.blobId);
+            if (!blob) {
+                cout << " - content missing" << endl;
+                continue;
+            }
+            if (!attachment.isNote) {
+                cout << " - " << attachment.blobId.substr(0, 12) << endl;
+                continue;
+            }
+            cout << ":" << endl;
+            if (!blob->forEachPiece([](const char* data, size_t length) {
+                    cout.write(data, length);
+                    return true;
+                })) {
+                cout << "[content missing]";
+            }
+            cout << endl;
+        }
+    }
+
+    size_t getTaskCount() const {
+        return tasks.size();
+    }
+
+    const Task& taskAt(size_t slot) const {
+        return tasks[slot];
+    }
+
+    // Slot of the task with the given ID, or -1 if there is none.
+    int slotOfTask(long long taskId) const {
+        return findSlot(taskId);
+    }
+
+    uint64_t getGeneration() const {
+        return generation.load();
+    }
+
+    // Brings session up to date with query and checks up to budget more tasks; returns true
+    // once its matches are complete.
+    bool advanceSearch(SearchSession& session, const string& query, size_t budget) const {
+        session.setQuery(query, tasks.size(), generation);
+        return session.step(tasks, budget);
+    }
+
+    void viewTasks(const string& filter) const {
+        cout << "Tasks:" << endl;
+        renderTasks(collectMatches(filter));
+    }
+
+    // Slots of the tasks whose description contains query, ignoring ASCII case.
+    vector<size_t> findTasks(const string& query) const {
+        OperationTimer timer(slowOps, "searchTasks", query, tasks, history);
+        vector<size_t> slots = scanner.scan(tasks, query);
+        timer.endPhase(OperationPhase::Lookup);
+        timer.setDetail(slots.size());
+        return slots;
+    }
+
+    void searchTasks(const string& query) const {
+        vector<size_t> slots = findTasks(query);
+        cout << "Matching tasks:" << endl;
+        renderTasks(slots);
+    }
+
+    void regexSearchTasks(const string& pattern) const {
+        OperationTimer timer(slowOps, "regexSearchTasks", pattern, tasks, history);
+        RegexMatcher matcher;
+        if (!matcher.compile(pattern)) {
+            cout << "Invalid pattern: " << matcher.getError() << endl;
+            return;
+        }
+
+        const string& literal = matcher.getRequiredLiteral();
+        vector<size_t> slots = parallelSelect(tasks, [&matcher, &literal]() {
+            return [matcher, &literal](const Task& task) mutable {
+                return DescriptionScanner::containsLower(task.getLowerDescription(), literal) &&
+                       matcher.matches(task.getDescription());
+            };
+        });
+        timer.endPhase(OperationPhase::Lookup);
+        timer.setDetail(slots.size());
+        cout << "Matching tasks:" << endl;
+        renderTasks(slots);
+    }
+
+    // Every word of the query must match some description word within a small edit distance.
+    void fuzzySearchTasks(const string& query) const {
+        OperationTimer timer(slowOps, "fuzzySearchTasks", query, tasks, history);
+        if (fuzzyIndexEvicted) {
+            fuzzyScanTasks(query, timer);
+            return;
+        }
+        vector<string> terms = splitWords(toLowerAscii(query));
+        if (terms.empty()) {
+            cout << "No matching tasks." << endl;
+            return;
+        }
+        vector<size_t> slots;
+        for (long long taskId : fuzzyIndex.matchAll(terms)) {
+            int slot = findSlot(taskId);
+            if (slot >= 0) {
+                slots.push_back(static_cast<size_t>(slot));
+            }
+        }
+        if (slots.empty()) {
+            cout << "No matching tasks." << endl;
+            return;
+        }
+        sort(slots.begin(), slots.end());
+        timer.endPhase(OperationPhase::Lookup);
+        timer.setDetail(slots.size());
+        cout << "Matching tasks:" << endl;
+        renderTasks(slots);
+    }
+
+    // Fuzzy search without the index, used while it is evicted: every description word is
+    // compared with the query words directly.
+    void fuzzyScanTasks(const string& query, OperationTimer& timer) const {
+        vector<string> terms = splitWords(toLowerAscii(query));
+        if (terms.empty()) {
+            cout << "No matching tasks." << endl;
+            return;
+        }
+        vector<size_t> slots = parallelSelect(tasks, [&terms]() {
+            return [&terms](const Task& task) {
+                vector<string> words = splitWords(task.getLowerDescription());
+                for (const string& term : terms) {
+                    int limit = term.size() <= 4 ? 1 : 2;
+                    bool found = false;
+                    for (const string& word : words) {
+                        if (FuzzyWordIndex::editDistance(term, word, limit) <= limit) {
+                            found = true;
+                            break;
+                        }
+                    }
+                    if (!found) {
+                        return false;
+                    }
+                }
+                return true;
+            };
+        });
+        timer.endPhase(OperationPhase::Lookup);
+        timer.setDetail(slots.size());
+        cout << "Matching tasks:" << endl;
+        renderTasks(slots);
+    }
+
+    // Runs the near-duplicate scan on a snapshot of the descriptions in the background. Calling
+    // again reports the clusters once the scan has finished; returns the number reported, which
+    // mergeNearDuplicates then accepts.
+    size_t findNearDuplicates() {
+        if (!nearDuplicateScan.valid()) {
+            auto snapshot = make_shared<DescriptionSnapshot>();
+            snapshot->ids.reserve(tasks.size());
+            snapshot->descriptions.reserve(tasks.size());
+            for (const auto& task : tasks) {
+                snapshot->ids.push_back(task.getId());
+                snapshot->descriptions.push_back(task.getDescription());
+            }
+            nearDuplicateSnapshot = snapshot;
+            nearDuplicateClusters.clear();
+            nearDuplicateGeneration = generation;
+            nearDuplicateScan = async(launch::async, [snapshot]() {
+                return NearDuplicateFinder().findClusters(snapshot->descriptions);
+            });
+            cout << "Near-duplicate scan started in the background; choose this option again for the report." << endl;
+            return 0;
+        }
+        if (nearDuplicateScan.wait_for(chrono::seconds(0)) != future_status::ready) {
+            cout << "Near-duplicate scan is still running." << endl;
+            return 0;
+        }
+
+        nearDuplicateClusters = nearDuplicateScan.get();
+        const vector<string>& descriptions = nearDuplicateSnapshot->descriptions;
+        cout << nearDuplicateClusters.size() << " near-duplicate cluster(s) found";
+        if (nearDuplicateGeneration != generation) {
+            cout << " (the list has changed since the scan; numbers refer to the scanned list)";
+        }
+        cout << ":" << endl;
+        for (size_t c = 0; c < nearDuplicateClusters.size(); ++c) {
+            cout << "Cluster " << c + 1 << ":" << endl;
+            for (size_t slot : nearDuplicateClusters[c]) {
+                cout << "  " << slot + 1 << ". " << descriptions[slot] << endl;
+            }
+        }
+        return nearDuplicateClusters.size();
+    }
+
+    // Merges cluster (1-based) of the last near-duplicate report into its first task that is
+    // still in the list: the others are deleted with their subtasks, as one undo step. Tasks
+    // gone or edited since the scan are left alone, as is a task the kept one is a subtask of.
+    void mergeNearDuplicates(size_t cluster) {
+        if (cluster == 0 || cluster > nearDuplicateClusters.size()) {
+            cout << "Invalid cluster number." << endl;
+            return;
+        }
+        OperationTimer timer(slowOps, "mergeNearDuplicates", static_cast<long long>(cluster), tasks, history);
+        long long keptId = 0;
+        unordered_set<size_t> slots;
+        for (size_t scanned : nearDuplicateClusters[cluster - 1]) {
+            int slot = findSlot(nearDuplicateSnapshot->ids[scanned]);
+            if (slot < 0 || tasks[slot].getDescription() != nearDuplicateSnapshot->descriptions[scanned]) {
+                continue;
+            }
+            if (keptId == 0) {
+                keptId = tasks[slot].getId();
+                continue;
+            }
+            vector<long long> subtree = tree.subtree(tasks[slot].getId());
+            if (find(subtree.begin(), subtree.end(), keptId) != subtree.end()) {
+                continue;
+            }
+            for (long long id : subtree) {
+                slots.insert(static_cast<size_t>(findSlot(id)));
+            }
+        }
+        timer.endPhase(OperationPhase::Lookup);
+        if (slots.empty()) {
+            cout << "Nothing left to merge in that cluster." << endl;
+            return;
+        }
+        timer.setTaskId(keptId);
+        deleteSlots(vector<size_t>(slots.begin(), slots.end()), timer);
+        cout << "Merged the cluster into task " << findSlot(keptId) + 1 << ", deleting " << slots.size() << " task(s)." << endl;
+    }
+
+    void showStats() const {
+        stats.display();
+        if (retentionPurged > 0) {
+            cout << "Purged by retention: " << retentionPurged << endl;
+        }
+    }
+
+    // Call with the command lock held; wakes the worker so the new rules apply right away.
+    void setRetentionPolicy(const RetentionPolicy& policy) {
+        retention = policy;
+        retentionWake.notify_one();
+    }
+
+    const RetentionPolicy& getRetentionPolicy() const {
+        return retention;
+    }
+
+    // Starts the background job that enforces the retention policy every interval. It also
+    // re-checks the memory budget and rebuilds an evicted index, a slice per lock hold, once the
+    // list has shrunk enough to hold it again.
+    void startRetention(chrono::milliseconds interval) {
+        stopRetention();
+        retentionStopping = false;
+        retentionWorker = thread([this, interval] {
+            unique_lock<mutex> lock(stateMutex);
+            while (!retentionStopping) {
+                lock.unlock();
+                runRetentionSweep();
+                lock.lock();
+                enforceMemoryBudget();
+                while (!retentionStopping && !advanceFuzzyRebuild()) {
+                    lock.unlock();
+                    this_thread::yield();
+                    lock.lock();
+                }
+                retentionWake.wait_for(lock, interval);
+            }
+        });
+    }
+
+    void stopRetention() {
+        if (retentionWorker.joinable()) {
+            {
+                lock_guard<mutex> lock(stateMutex);
+                retentionStopping = true;
+            }
+            retentionWake.notify_one();
+            retentionWorker.join();
+        }
+    }
+
+    // One pass of the retention policy, run as a sequence of advanceRetention slices each under
+    // the lock on its own, so a foreground command never waits for more than one slice. Returns
+    // the number of tasks purged.
+    size_t runRetentionSweep() {
+        RetentionSweep sweep;
+        for (bool done = false; !done;) {
+            lock_guard<mutex> lock(stateMutex);
+            if (retentionStopping) {
+                break;
+            }
+            done = advanceRetention(sweep);
+            this_thread::yield();
+        }
+        return sweep.purged;
+    }
+
+    // Does one slice of a retention pass: scanning a range of slots for completed tasks, or, as
+    // the last slice, purging all of those the policy selects. Purged tasks leave the indexes and
+    // are not recorded for undo. Call with the command lock held; returns true when the pass is
+    // complete.
+    bool advanceRetention(RetentionSweep& sweep) {
+        if (!sweep.collected) {
+            if (sweep.scanned == 0) {
+                sweep.policy = retention;
+            }
+            if (sweep.policy.maxCompletedAgeDays == 0 && sweep.policy.maxCompletedKept == 0) {
+                return true;
+            }
+            size_t end = min(tasks.size(), sweep.scanned + retentionScanSlice);
+            for (size_t i = sweep.scanned; i < end; ++i) {
+                if (tasks[i].isCompleted()) {
+                    sweep.completed.emplace_back(tasks[i].getCompletedAt(), tasks[i].getId());
+                }
+            }
+            sweep.scanned = end;
+            if (end < tasks.size()) {
+                return false;
+            }
+
+            vector<pair<long long, long long>>& completed = sweep.completed;
+            sort(completed.rbegin(), completed.rend());
+            long long cutoff = currentTimestamp() - sweep.policy.maxCompletedAgeDays * 24 * 60 * 60;
+            size_t kept = 0;
+            for (size_t i = 0; i < completed.size(); ++i) {
+                if ((sweep.policy.maxCompletedKept > 0 && i >= sweep.policy.maxCompletedKept) ||
+                    (sweep.policy.maxCompletedAgeDays > 0 && completed[i].first < cutoff)) {
+                    completed[kept++] = completed[i];
+                }
+            }
+            completed.resize(kept);
+            sweep.collected = true;
+            return completed.empty();
+        }
+
+        sweep.purged += purgeTasks(sweep.completed);
+        return true;
+    }
+
+    // Bytes this list may use; 0 means no limit. Call with the command lock held.
+    void setMemoryBudget(size_t bytes) {
+        memoryBudget = bytes;
+        enforceMemoryBudget();
+    }
+
+    size_t getMemoryBudget() const {
+        return memoryBudget;
+    }
+
+    // Kept up to date by every change, so this is cheap enough to check on each write.
+    MemoryUsage memoryUsage() const {
+        MemoryUsage usage;
+        usage.tasks = tasks.capacity() * sizeof(Task) + taskHeapBytes;
+        usage.history = history.memoryBytes();
+        usage.indexes = fuzzyIndex.memoryBytes() + fuzzyRebuildIds.capacity() * sizeof(long long) + duplicates.memoryBytes() +
+                        stats.memoryBytes() + tree.memoryBytes();
+        usage.events = events.memoryBytes();
+        if (!slotCache.empty()) {
+            usage.caches = slotCache.size() * (sizeof(pair<const long long, CachedSlot>) + sizeof(void*)) +
+                           slotCache.bucket_count() * sizeof(void*);
+            for (const SlotEdit& edit : slotEdits) {
+                usage.caches += sizeof(SlotEdit) + (edit.removed.capacity() + edit.insertedAfter.capacity()) * sizeof(size_t);
+            }
+        }
+        usage.caches += timeline.memoryBytes();
+        return usage;
+    }
+
+    const MemoryEvictions& getMemoryEvictions() const {
+        return memoryEvictions;
+    }
+
+    bool isOverMemoryBudget() const {
+        return overBudget;
+    }
+
+    string memoryMetrics() const {
+        MemoryUsage usage = memoryUsage();
+        return "mem_bytes=" + to_string(usage.total()) + " mem_budget=" + to_string(memoryBudget) +
+               " mem_tasks=" + to_string(usage.tasks) + " mem_history=" + to_string(usage.history) +
+               " mem_indexes=" + to_string(usage.indexes) + " mem_events=" + to_string(usage.events) +
+               " mem_caches=" + to_string(usage.caches) + " over_budget=" + to_string(overBudget ? 1 : 0) +
+               " history_trims=" + to_string(memoryEvictions.historyTrims) +
+               " history_dropped=" + to_string(memoryEvictions.historyEntriesDropped) +
+               " cache_evictions=" + to_string(memoryEvictions.cacheEvictions) +
+               " index_evictions=" + to_string(memoryEvictions.indexEvictions) +
+               " index_rebuilds=" + to_string(memoryEvictions.indexRebuilds) +
+               " rejected_writes=" + to_string(memoryEvictions.rejectedWrites);
+    }
+
+    void showMemory() const {
+        MemoryUsage usage = memoryUsage();
+        cout << "Memory use: ~" << usage.total() << " bytes";
+        if (memoryBudget > 0) {
+            cout << " of a " << memoryBudget << " byte budget" << (overBudget ? " (over budget, adding is refused)" : "");
+        }
+        cout << endl;
+        cout << "  Tasks: " << usage.tasks << ", undo history: " << usage.history << ", indexes: " << usage.indexes
+             << ", event log: " << usage.events << ", caches: " << usage.caches << endl;
+        cout << "  History trims: " << memoryEvictions.historyTrims << " (" << memoryEvictions.historyEntriesDropped
+             << " entries dropped), cache evictions: " << memoryEvictions.cacheEvictions
+             << ", index evictions: " << memoryEvictions.indexEvictions << ", index rebuilds: " << memoryEvictions.indexRebuilds
+             << ", refused writes: " << memoryEvictions.rejectedWrites << endl;
+        if (!memoryEvictions.lastAction.empty()) {
+            cout << "  Last action: " << memoryEvictions.lastAction << endl;
+        }
+    }
+
+    // Brings the list back within its budget, giving up what is cheapest to lose first: the
+    // oldest undo history (saved entries are only unloaded), then the caches, then the fuzzy
+    // index (fuzzy search scans the list instead). The duplicate index stays, since it enforces
+    // a rule rather than speeding up a query. Each step aims for 90% of the budget so the next
+    // writes do not trigger it again at once, and an evicted index is rebuilt in the background
+    // once it fits again. Call with the command lock held; returns false if the list is still
+    // over budget.
+    bool enforceMemoryBudget() {
+        if (memoryBudget == 0) {
+            overBudget = false;
+            startFuzzyRebuild();
+            return true;
+        }
+        size_t target = memoryBudget - memoryBudget / 10;
+        MemoryUsage usage = memoryUsage();
+        if (usage.total() <= memoryBudget) {
+            overBudget = false;
+            if (usage.total() + evictedIndexBytes <= target) {
+                startFuzzyRebuild();
+            }
+            return true;
+        }
+
+        if (usage.history > 0) {
+            size_t depthBefore = history.depth();
+            size_t dropped = history.dropOldest(usage.total() - target);
+            forgetOldestHistory(depthBefore - history.depth());
+            ++memoryEvictions.historyTrims;
+            memoryEvictions.historyEntriesDropped += dropped;
+            memoryEvictions.lastAction = dropped == 0 ? "unloaded the oldest saved undo entries"
+                                                      : "dropped the " + to_string(dropped) + " oldest undo entries";
+            usage = memoryUsage();
+        }
+        if (usage.total() > target && usage.caches > 0) {
+            clearSlotCache();
+            timeline.evictCaches();
+            ++memoryEvictions.cacheEvictions;
+            memoryEvictions.lastAction = "evicted the slot cache and timeline snapshots";
+            usage = memoryUsage();
+        }
+        if (usage.total() > target && (!fuzzyIndexEvicted || fuzzyIndexRebuilding)) {
+            if (!fuzzyIndexRebuilding) {
+                evictedIndexBytes = fuzzyIndex.memoryBytes();
+            }
+            fuzzyIndex.clear();
+            fuzzyIndexEvicted = true;
+            fuzzyIndexRebuilding = false;
+            fuzzyRebuildIds = vector<long long>();
+            ++memoryEvictions.indexEvictions;
+            memoryEvictions.lastAction = "evicted the fuzzy search index";
+            usage = memoryUsage();
+        }
+        overBudget = usage.total() > memoryBudget;
+        return !overBudget;
+    }
+
+    void viewTasksAsOf(long long timestamp) {
+        shared_ptr<const vector<Task>> snapshot = timeline.asOf(events, timestamp);
+        cout << "Tasks:" << endl;
+        for (size_t i = 0; i < snapshot->size(); ++i) {
+            (*snapshot)[i].display(i);
+        }
+    }
+
+    // Throughput, lead time and a daily burndown for the days [fromDay, toDay], from the event log.
+    void showAnalytics(long long fromDay, long long toDay) const {
+        const long long day = 24 * 60 * 60;
+        long long from = fromDay * day;
+        long long to = (toDay + 1) * day;
+
+        cout << "Completed tasks: " << events.throughput(from, to) << endl;
+        LeadTimeSummary leadTimes = events.leadTimes(from, to);
+        if (leadTimes.samples > 0) {
+            cout << "Lead time (hours): p50 " << leadTimes.p50 / 3600.0 << ", p90 " << leadTimes.p90 / 3600.0 << ", p99 "
+                 << leadTimes.p99 / 3600.0 << endl;
+        }
+        cout << "Open tasks at the start of each day:" << endl;
+        vector<long long> burndown = events.burndown(from, to, day);
+        for (size_t i = 0; i < burndown.size(); ++i) {
+            if (i + 1 == burndown.size()) {
+                cout << "  End of " << civilFromDays(toDay) << ": " << burndown[i] << endl;
+            } else {
+                cout << "  " << civilFromDays(fromDay + static_cast<long long>(i)) << ": " << burndown[i] << endl;
+            }
+        }
+        if (loadedAt > 0 && from < loadedAt) {
+            cout << "Before " << civilFromDays(loadedAt / day)
+                 << " only tasks still in the list count; earlier deletions and reopenings are not recorded." << endl;
+        }
+    }
+
+    // Changes to the same task closer together than this are undone as one step; 0 disables.
+    void setHistoryCoalesceWindow(long long millis) {
+        history.setCoalesceWindow(millis);
+    }
+
+    void setPrefetchDistance(size_t distance) {
+        prefetchDistance = distance;
+    }
+
+    // Returns the number of steps undone, without printing anything.
+    size_t applyUndo(size_t steps) {
+        OperationTimer timer(slowOps, "undo", steps, tasks, history);
+        return undoSteps(steps, timer);
+    }
+
+    size_t applyRedo(size_t steps) {
+        OperationTimer timer(slowOps, "redo", steps, tasks, history);
+        return redoSteps(steps, timer);
+    }
+
+    void undo(size_t steps = 1) {
+        size_t undone = applyUndo(steps);
+        if (undone == 0) {
+            cout << "Nothing to undo." << endl;
+        } else if (steps == 1) {
+            cout << "Undo successful." << endl;
+        } else {
+            cout << "Undid " << undone << " step(s)." << endl;
+        }
+    }
+
+    void redo(size_t steps = 1) {
+        size_t redone = applyRedo(steps);
+        if (redone == 0) {
+            cout << "Nothing to redo." << endl;
+        } else if (steps == 1) {
+            cout << "Redo successful." << endl;
+        } else {
+            cout << "Redid " << redone << " step(s)." << endl;
+        }
+    }
+
+    void setHistoryCheckpoint(const string& name) {
+        historyCheckpoints[name] = history.depth();
+        history.breakCoalescing();
+    }
+
+    void undoToCheckpoint(const string& name) {
+        auto found = historyCheckpoints.find(name);
+        if (found == historyCheckpoints.end()) {
+            cout << "No such checkpoint." << endl;
+        } else if (history.depth() < found->second) {
+            cout << "The history is already before that checkpoint." << endl;
+        } else {
+            undo(history.depth() - found->second);
+        }
+    }
+
+    // Loads <basePath>.tasks, written by this or any earlier format version. The undo history in
+    // <basePath>.history is only attached here; its entries are read when undo first needs them.
+    // A missing state file is an empty list. Returns false, leaving the list empty, if the file
+    // exists but cannot be read; save() then refuses to overwrite it.
+    bool load(const string& basePath) {
+        statePath = basePath + ".tasks";
+        historyPath = basePath + ".history";
+        pendingHistoryPath = basePath + ".history.pending";
+        blobs = BlobStore(basePath + ".blobs");
+        string contents;
+        if (!readFile(statePath, contents)) {
+            loadFailed = filesystem::exists(statePath);
+            return !loadFailed;
+        }
+        loadFailed = true;
+
+        BinaryReader reader(contents.data(), contents.size());
+        string magic;
+        if (!reader.readString(magic) || magic.compare(0, stateMagicPrefix.size(), stateMagicPrefix) != 0) {
+            return false;
+        }
+        int version = atoi(magic.c_str() + stateMagicPrefix.size());
+        if (version < 1 || version > stateFormatVersion) {
+            return false;
+        }
+        reader.setFormatVersion(version);
+
+        uint64_t taskCount, historyEnd, historyCount, sequence = 0, tailStart = 0, maxCompletedKept = 0;
+        long long storedNextId, maxCompletedAgeDays = 0;
+        if (!reader.readSigned(storedNextId) || !reader.readUnsigned(historyEnd) || !reader.readUnsigned(historyCount) ||
+            (version >= 6 && (!reader.readUnsigned(sequence) || !reader.readUnsigned(tailStart))) ||
+            (version >= 5 && (!reader.readSigned(maxCompletedAgeDays) || !reader.readUnsigned(maxCompletedKept))) ||
+            !reader.readUnsigned(taskCount)) {
+            return false;
+        }
+        vector<Task> loaded;
+        for (uint64_t i = 0; i < taskCount; ++i) {
+            unique_ptr<TaskMemento> memento;
+            if (!reader.readMemento(memento)) {
+                return false;
+            }
+            loaded.push_back(Task::fromMemento(*memento));
+        }
+        if (!history.readRedo(reader) || (version >= 7 && !history.readForgotten(reader))) {
+            return false;
+        }
+        if (filesystem::exists(pendingHistoryPath)) {
+            TaskHistory::applyPendingTail(historyPath, pendingHistoryPath, sequence, tailStart);
+        }
+
+        for (const Task& task : loaded) {
+            tasks.push_back(task);
+            cacheLastSlot();
+            indexTask(tasks.back());
+        }
+        seedEvents(loaded);
+        nextTaskId = storedNextId;
+        saveSequence = sequence;
+        retention.maxCompletedAgeDays = maxCompletedAgeDays;
+        retention.maxCompletedKept = maxCompletedKept;
+        history.attachFile(historyPath, historyEnd, historyCount, version);
+        loadFailed = false;
+        return true;
+    }
+
+    // The history records go to a pending file first and the state file, naming that file's
+    // sequence, is replaced after; only then is the history file changed. Whichever step a crash
+    // interrupts, the next load sees either the old state and history or the new ones.
+    bool save() {
+        OperationTimer timer(slowOps, "save", statePath, tasks, history);
+        if (statePath.empty() || loadFailed) {
+            return false;
+        }
+        uint64_t sequence = saveSequence + 1;
+        uint64_t tailStart, historyEnd;
+        size_t historyCount;
+        if (!history.writePendingTail(historyPath, pendingHistoryPath, sequence, tailStart, historyEnd, historyCount)) {
+            return false;
+        }
+
+        BinaryWriter writer;
+        writer.writeString(stateMagicPrefix + to_string(stateFormatVersion));
+        writer.writeSigned(nextTaskId);
+        writer.writeUnsigned(historyEnd);
+        writer.writeUnsigned(historyCount);
+        writer.writeUnsigned(sequence);
+        writer.writeUnsigned(tailStart);
+        writer.writeSigned(retention.maxCompletedAgeDays);
+        writer.writeUnsigned(retention.maxCompletedKept);
+        writer.writeUnsigned(tasks.size());
+        for (const Task& task : tasks) {
+            writer.writeMemento(task.save());
+        }
+        history.writeRedo(writer);
+        history.writeForgotten(writer);
+        timer.setDetail(writer.data().size());
+        if (!writeFileAtomically(statePath, writer.data())) {
+            remove(pendingHistoryPath.c_str());
+            return false;
+        }
+        saveSequence = sequence;
+        bool written = TaskHistory::applyPendingTail(historyPath, pendingHistoryPath, sequence, tailStart);
+        history.finishSave(written);
+        timer.endPhase(OperationPhase::Persist);
+        return written;
+    }
+
+    void showSlowOperations() const {
+        slowOps.display();
+    }
+
+    void setSlowOperationThreshold(chrono::nanoseconds threshold) {
+        slowOps.setThreshold(threshold);
+    }
+
+private:
+    void indexTask(const Task& task) {
+        ++generation;
+        taskHeapBytes += task.heapBytes();
+        if (!fuzzyIndexEvicted || fuzzyIndexRebuilding) {
+            fuzzyIndex.add(task);
+        }
+        stats.add(task);
+        tree.add(task);
+        if (dedupeEnabled) {
+            duplicates.add(task);
+        }
+    }
+
+    void unindexTask(const Task& task) {
+        ++generation;
+        taskHeapBytes -= task.heapBytes();
+        if (!fuzzyIndexEvicted || fuzzyIndexRebuilding) {
+            fuzzyIndex.remove(task);
+        }
+        stats.remove(task);
+        tree.remove(task);
+        if (dedupeEnabled) {
+            duplicates.remove(task);
+        }
+    }
+
+    // Writes that add data are refused once giving up history, caches and indexes was not enough.
+    bool admitWrite() {
+        if (enforceMemoryBudget()) {
+            return true;
+        }
+        ++memoryEvictions.rejectedWrites;
+        memoryEvictions.lastAction = "refused a write";
+        return false;
+    }
+
+    // Starts rebuilding an evicted fuzzy index from the IDs of the current tasks. The retention
+    // worker does the work in advanceFuzzyRebuild slices; tasks that change in the meantime are
+    // indexed as they change, and fuzzy search keeps scanning until the index is complete.
+    void startFuzzyRebuild() {
+        if (!fuzzyIndexEvicted || fuzzyIndexRebuilding) {
+            return;
+        }
+        fuzzyRebuildIds.clear();
+        fuzzyRebuildIds.reserve(tasks.size());
+        for (const Task& task : tasks) {
+            fuzzyRebuildIds.push_back(task.getId());
+        }
+        fuzzyRebuildNext = 0;
+        fuzzyIndexRebuilding = true;
+        retentionWake.notify_one();
+    }
+
+    // Indexes the next slice of the tasks listed when the rebuild started; those removed since
+    // are skipped. Adding a task twice is harmless, so the slices need not know which tasks were
+    // indexed as they changed. Call with the command lock held; returns true once no rebuild is
+    // left to do.
+    bool advanceFuzzyRebuild() {
+        if (!fuzzyIndexRebuilding) {
+            return true;
+        }
+        size_t end = min(fuzzyRebuildIds.size(), fuzzyRebuildNext + fuzzyRebuildSlice);
+        for (; fuzzyRebuildNext < end; ++fuzzyRebuildNext) {
+            int slot = findSlot(fuzzyRebuildIds[fuzzyRebuildNext]);
+            if (slot >= 0) {
+                fuzzyIndex.add(tasks[slot]);
+            }
+        }
+        if (fuzzyRebuildNext < fuzzyRebuildIds.size()) {
+            return false;
+        }
+        fuzzyRebuildIds = vector<long long>();
+        fuzzyIndexRebuilding = false;
+        fuzzyIndexEvicted = false;
+        ++memoryEvictions.indexRebuilds;
+        memoryEvictions.lastAction = "rebuilt the fuzzy search index";
+        return true;
+    }
+
+    // Deletes the tasks at the given slots as one undo step.
+    void deleteSlots(vector<size_t> slots, OperationTimer& timer) {
+        // Recorded from the highest slot down, so each entry's position is still its original
+        // slot and undo re-inserts them in ascending order.
+        sort(slots.rbegin(), slots.rend());
+        vector<TaskEvent> deletions;
+        vector<bool> removed(tasks.size(), false);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            const Task& task = tasks[slots[i]];
+            recordChange(snapshotOf(slots[i]), i > 0);
+            unindexTask(task);
+            deletions.push_back(TaskEvent{currentTimestamp(), TaskEventType::Deleted, task.getId(), 0, task.isCompleted() ? 0 : -1});
+            removed[slots[i]] = true;
+        }
+
+        timer.endPhase(OperationPhase::IndexUpdate);
+        compactTasks(removed);
+        timer.endPhase(OperationPhase::Mutate);
+        for (const TaskEvent& deleted : deletions) {
+            logEvent(deleted);
+        }
+        timer.endPhase(OperationPhase::IndexUpdate);
+    }
+
+    // Records a change for undo. It clears the redo stack, so checkpoints set above the current
+    // depth, before an undo, can no longer be reached and would otherwise come to name the
+    // depth of later, unrelated changes.
+    void recordChange(const TaskMemento& memento, bool chained = false) {
+        if (!history.isRedoStackEmpty()) {
+            size_t depth = history.depth();
+            for (auto it = historyCheckpoints.begin(); it != historyCheckpoints.end();) {
+                it = it->second > depth ? historyCheckpoints.erase(it) : next(it);
+            }
+        }
+        history.addMemento(memento, chained);
+    }
+
+    // Checkpoints are undo depths, so they move down with the oldest entries dropped beneath them;
+    // those set before the dropped entries can no longer be reached.
+    void forgetOldestHistory(size_t removed) {
+        for (auto it = historyCheckpoints.begin(); it != historyCheckpoints.end();) {
+            if (it->second < removed) {
+                it = historyCheckpoints.erase(it);
+            } else {
+                it->second -= removed;
+                ++it;
+            }
+        }
+    }
+
+    // Removes those of the given completed tasks that have not changed since the sweep saw them
+    // and have no subtasks left, matching them by ID in a single pass over the list, and forgets
+    // their undo entries.
+    size_t purgeTasks(const vector<pair<long long, long long>>& victims) {
+        unordered_map<long long, long long> completedAt; // Task ID -> completion time the sweep saw
+        completedAt.reserve(victims.size());
+        for (const auto& victim : victims) {
+            completedAt.emplace(victim.second, victim.first);
+        }
+        vector<bool> removed(tasks.size(), false);
+        unordered_set<long long> purgedIds;
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            auto victim = completedAt.find(tasks[i].getId());
+            if (victim != completedAt.end() && tasks[i].isCompleted() && tasks[i].getCompletedAt() == victim->second &&
+                tree.subtreeSize(victim->first) <= 1) {
+                removed[i] = true;
+                purgedIds.insert(victim->first);
+            }
+        }
+        if (purgedIds.empty()) {
+            return 0;
+        }
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            if (removed[i]) {
+                unindexTask(tasks[i]);
+                logEvent(TaskEvent{currentTimestamp(), TaskEventType::Deleted, tasks[i].getId(), 0, 0});
+            }
+        }
+        compactTasks(removed);
+        history.forgetTasks(purgedIds);
+        retentionPurged += purgedIds.size();
+        return purgedIds.size();
+    }
+
+    // Slots of the tasks as of the first editsSeen layout edits; see findSlot.
+    struct CachedSlot {
+        size_t slot;
+        size_t editsSeen;
+    };
+
+    // Tasks removed and inserted by one change to the layout of the list.
+    struct SlotEdit {
+        vector<size_t> removed;       // Slots before the change, ascending
+        vector<size_t> insertedAfter; // For each inserted task, in order, the number of remaining tasks before it
+    };
+
+    static const size_t maxSlotEdits = 64;
+
+    void compactTasks(const vector<bool>& removed) {
+        SlotEdit edit;
+        size_t kept = 0;
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            if (!removed[i]) {
+                if (kept != i) {
+                    tasks[kept] = move(tasks[i]);
+                }
+                ++kept;
+            } else if (!slotCache.empty()) {
+                slotCache.erase(tasks[i].getId());
+                edit.removed.push_back(i);
+            }
+        }
+        tasks.erase(tasks.begin() + kept, tasks.end());
+        logSlotEdit(move(edit));
+    }
+
+    // The slot cache holds every task once built. Removals and inserts in the middle of the list
+    // are not applied to each entry but logged; an entry is carried through the edits logged
+    // after it was written when it is next looked up. The log is bounded: when it fills, the
+    // cache is dropped and built again by the next lookup, so that cost is shared by many edits,
+    // each of which already moved a part of the list. An ID the cache lacks has no task.
+    int findSlot(long long taskId) const {
+        if (slotCache.empty()) {
+            for (size_t i = 0; i < tasks.size(); ++i) {
+                slotCache[tasks[i].getId()] = CachedSlot{i, slotEdits.size()};
+            }
+        }
+        auto cached = slotCache.find(taskId);
+        if (cached == slotCache.end()) {
+            return -1;
+        }
+        CachedSlot& entry = cached->second;
+        for (; entry.editsSeen < slotEdits.size(); ++entry.editsSeen) {
+            const SlotEdit& edit = slotEdits[entry.editsSeen];
+            entry.slot -= lower_bound(edit.removed.begin(), edit.removed.end(), entry.slot) - edit.removed.begin();
+            entry.slot += upper_bound(edit.insertedAfter.begin(), edit.insertedAfter.end(), entry.slot) - edit.insertedAfter.begin();
+        }
+        return static_cast<int>(entry.slot);
+    }
+
+    // Call right after appending to tasks; appending moves no other task.
+    void cacheLastSlot() {
+        if (!slotCache.empty()) {
+            slotCache[tasks.back().getId()] = CachedSlot{tasks.size() - 1, slotEdits.size()};
+        }
+    }
+
+    void logSlotEdit(SlotEdit edit) {
+        if (slotCache.empty() || (edit.removed.empty() && edit.insertedAfter.empty())) {
+            return;
+        }
+        if (slotEdits.size() >= maxSlotEdits) {
+            clearSlotCache();
+            return;
+        }
+        slotEdits.push_back(move(edit));
+    }
+
+    void clearSlotCache() {
+        slotCache = unordered_map<long long, CachedSlot>();
+        slotEdits = vector<SlotEdit>();
+    }
+
+    TaskMemento snapshotOf(size_t slot) const {
+        TaskMemento memento = tasks[slot].save();
+        memento.setPosition(slot);
+        return memento;
+    }
+
+    TaskMemento currentStateFor(const TaskMemento& memento) const {
+        int slot = findSlot(memento.getTaskId());
+        return slot < 0 ? TaskMemento::absent(memento.getTaskId(), memento.getPosition()) : snapshotOf(slot);
+    }
+
+    size_t undoSteps(size_t steps, OperationTimer& timer) {
+        return replaySteps(
+            steps, timer, [this]() { return !history.isEmpty(); }, [this]() { return history.getMemento(); },
+            [this](const TaskMemento& inverse) { history.addRedoMemento(inverse); });
+    }
+
+    size_t redoSteps(size_t steps, OperationTimer& timer) {
+        return replaySteps(
+            steps, timer, [this]() { return !history.isRedoStackEmpty(); }, [this]() { return history.redo(); },
+            [this](const TaskMemento& inverse) { history.addUndoMemento(inverse); });
+    }
+
+    // A task touched by a replay: its slot before the replay (-1 if it had none), the edit that
+    // last inserted it, whether it is in the list now and its state now.
+    struct ReplayTarget {
+        TaskMemento state;
+        int slot;
+        size_t origin;
+        bool listed;
+    };
+
+    struct ReplayEdit {
+        bool insert; // Otherwise a removal
+        size_t position;
+    };
+
+    static const size_t noReplayEdit = numeric_limits<size_t>::max();
+    static const size_t maxInsertsInPlace = 8; // More tasks entering the list at once are merged in
+
+    // Several undo or redo steps are first worked out on the tasks they touch alone: each step's
+    // inverse (the state it replaces, at the slot it occupied then) is pushed onto the opposite
+    // stack while only the net target state per task and the inserts and removals so far are
+    // kept. A task's slot at any point is its slot before the steps, or where a step inserted it,
+    // carried through the later inserts and removals, so the work grows with the steps and not
+    // with the list. The list is then changed once, so every affected task and its index entries
+    // are touched a single time.
+    template <typename HasNext, typename Next, typename PushInverse>
+    size_t replaySteps(size_t steps, OperationTimer& timer, HasNext hasNext, Next next, PushInverse pushInverse) {
+        unordered_map<long long, ReplayTarget> targets; // Task ID -> where it is and its state after the steps so far
+        vector<ReplayEdit> edits;
+        size_t listSize = tasks.size();
+        size_t done = 0;
+        for (; done < steps && hasNext(); ++done) {
+            // A logical step is one entry plus every entry chained to it, such as a subtree delete.
+            bool firstOfStep = true;
+            bool chained = true;
+            while (chained && hasNext()) {
+                TaskMemento memento = next();
+                chained = memento.isChained();
+                long long id = memento.getTaskId();
+                auto found = targets.find(id);
+                if (found == targets.end()) {
+                    int slot = findSlot(id);
+                    TaskMemento state = slot < 0 ? TaskMemento::absent(id, memento.getPosition()) : snapshotOf(slot);
+                    found = targets.emplace(id, ReplayTarget{state, slot, noReplayEdit, slot >= 0}).first;
+                }
+                ReplayTarget& target = found->second;
+                size_t position = target.listed ? replayPosition(target, edits) : memento.getPosition();
+
+                TaskMemento inverse = target.state;
+                inverse.setPosition(position);
+                inverse.setRecordedAt(0);
+                inverse.setChained(!firstOfStep);
+                firstOfStep = false;
+                pushInverse(inverse);
+                target.state = memento;
+
+                if (memento.isPresent() && !target.listed) {
+                    target.origin = edits.size();
+                    target.listed = true;
+                    edits.push_back(ReplayEdit{true, min(memento.getPosition(), listSize++)});
+                } else if (!memento.isPresent() && target.listed) {
+                    target.listed = false;
+                    edits.push_back(ReplayEdit{false, position});
+                    --listSize;
+                }
+            }
+        }
+        timer.endPhase(OperationPhase::Lookup);
+        applyReplay(targets, edits);
+        timer.endPhase(OperationPhase::Mutate);
+        return done;
+    }
+
+    // The slot a listed target has after all edits so far.
+    static size_t replayPosition(const ReplayTarget& target, const vector<ReplayEdit>& edits) {
+        bool inserted = target.origin != noReplayEdit;
+        size_t position = inserted ? edits[target.origin].position : static_cast<size_t>(target.slot);
+        for (size_t i = inserted ? target.origin + 1 : 0; i < edits.size(); ++i) {
+            if (edits[i].insert && edits[i].position <= position) {
+                ++position;
+            } else if (!edits[i].insert && edits[i].position < position) {
+                --position;
+            }
+        }
+        return position;
+    }
+
+    // Tasks that stay where they were are restored in place. Tasks leaving the list go in one
+    // compaction, and entering ones are then put at their final slots, one by one if there are
+    // few or by a single merge. A task removed and put back by the steps keeps its record.
+    void applyReplay(const unordered_map<long long, ReplayTarget>& targets, const vector<ReplayEdit>& edits) {
+        vector<pair<size_t, const ReplayTarget*>> entering; // Final slot -> target
+        vector<bool> removed;
+        for (const auto& entry : targets) {
+            const ReplayTarget& target = entry.second;
+            if (target.slot >= 0 && target.listed && target.origin == noReplayEdit) {
+                restoreTask(tasks[target.slot], target.state);
+                continue;
+            }
+            if (target.slot >= 0) {
+                removed.resize(tasks.size(), false);
+                removed[target.slot] = true;
+            }
+            if (target.listed) {
+                entering.emplace_back(replayPosition(target, edits), &target);
+            }
+        }
+        if (removed.empty() && entering.empty()) {
+            return;
+        }
+
+        sort(entering.begin(), entering.end(),
+             [](const pair<size_t, const ReplayTarget*>& a, const pair<size_t, const ReplayTarget*>& b) { return a.first < b.first; });
+        vector<Task> arriving;
+        arriving.reserve(entering.size());
+        for (const auto& arrival : entering) {
+            const ReplayTarget& target = *arrival.second;
+            arriving.push_back(target.slot >= 0 ? move(tasks[target.slot]) : Task::fromMemento(target.state));
+        }
+        vector<TaskEvent> changes;
+        for (size_t i = 0; i < removed.size(); ++i) {
+            // Returning tasks were moved out above; their index entries stay until restoreTask.
+            if (removed[i] && !targets.at(tasks[i].getId()).listed) {
+                unindexTask(tasks[i]);
+                changes.push_back(TaskEvent{currentTimestamp(), TaskEventType::Deleted, tasks[i].getId(), 0, tasks[i].isCompleted() ? 0 : -1});
+            }
+        }
+        if (!removed.empty()) {
+            compactTasks(removed);
+        }
+        if (entering.empty()) {
+            for (const TaskEvent& change : changes) {
+                logEvent(change);
+            }
+            return;
+        }
+
+        if (arriving.size() <= maxInsertsInPlace) {
+            for (size_t j = 0; j < arriving.size(); ++j) {
+                tasks.insert(tasks.begin() + min(entering[j].first, tasks.size()), move(arriving[j]));
+                entering[j].first = min(entering[j].first, tasks.size() - 1);
+            }
+        } else {
+            vector<Task> arranged;
+            arranged.reserve(tasks.size() + arriving.size());
+            size_t nextArrival = 0;
+            for (size_t i = 0; i <= tasks.size(); ++i) {
+                for (; nextArrival < arriving.size() && (entering[nextArrival].first <= arranged.size() || i == tasks.size());
+                     ++nextArrival) {
+                    entering[nextArrival].first = arranged.size();
+                    arranged.push_back(move(arriving[nextArrival]));
+                }
+                if (i < tasks.size()) {
+                    arranged.push_back(move(tasks[i]));
+                }
+            }
+            tasks.swap(arranged);
+        }
+
+        SlotEdit edit;
+        for (size_t j = 0; j < entering.size(); ++j) {
+            const ReplayTarget& target = *entering[j].second;
+            Task& task = tasks[entering[j].first];
+            if (target.slot >= 0) {
+                restoreTask(task, target.state);
+            } else {
+                indexTask(task);
+                changes.push_back(TaskEvent{currentTimestamp(), TaskEventType::Created, task.getId(), 0, task.isCompleted() ? 0 : 1,
+                                            make_shared<const Task>(task)});
+            }
+            edit.insertedAfter.push_back(entering[j].first - j);
+        }
+        logSlotEdit(move(edit));
+        for (size_t j = 0; j < entering.size() && !slotCache.empty(); ++j) {
+            slotCache[entering[j].second->state.getTaskId()] = CachedSlot{entering[j].first, slotEdits.size()};
+        }
+        for (const TaskEvent& change : changes) {
+            logEvent(change);
+        }
+    }
+
+    void restoreTask(Task& task, const TaskMemento& memento) {
+        bool wasCompleted = task.isCompleted();
+        unindexTask(task);
+        task.restore(memento);
+        indexTask(task);
+        if (task.isCompleted() != wasCompleted) {
+            logStatusChange(task, currentTimestamp());
+        }
+    }
+
+    // The event log is not saved. After a load it is rebuilt from the tasks' own creation and
+    // completion times, in time order, so as-of views and analytics reach back before the load
+    // for the tasks still in the list; deletions and reopenings before it are not known.
+    void seedEvents(const vector<Task>& loaded) {
+        long long now = currentTimestamp();
+        loadedAt = loaded.empty() ? 0 : now;
+        vector<TaskEvent> seeded;
+        for (const Task& task : loaded) {
+            long long createdAt = min(task.getCreatedAt(), now);
+            if (!task.isCompleted() || task.getCompletedAt() == 0) {
+                // A completion of unknown time counts as done from the start.
+                seeded.push_back(TaskEvent{createdAt, TaskEventType::Created, task.getId(), 0, task.isCompleted() ? 0 : 1,
+                                           make_shared<const Task>(task)});
+                continue;
+            }
+            Task asCreated = task;
+            asCreated.markPending();
+            seeded.push_back(
+                TaskEvent{createdAt, TaskEventType::Created, task.getId(), 0, 1, make_shared<const Task>(asCreated)});
+            seeded.push_back(TaskEvent{min(max(task.getCompletedAt(), createdAt), now), TaskEventType::Completed, task.getId(),
+                                       task.getCompletedAt() - task.getCreatedAt(), -1});
+        }
+        stable_sort(seeded.begin(), seeded.end(),
+                    [](const TaskEvent& a, const TaskEvent& b) { return a.timestamp < b.timestamp; });
+        for (const TaskEvent& event : seeded) {
+            logEvent(event);
+        }
+    }
+
+    void logStatusChange(const Task& task, long long timestamp) {
+        if (task.isCompleted()) {
+            logEvent(TaskEvent{timestamp, TaskEventType::Completed, task.getId(), task.getCompletedAt() - task.getCreatedAt(), -1});
+        } else {
+            logEvent(TaskEvent{timestamp, TaskEventType::Reopened, task.getId(), 0, 1});
+        }
+    }
+
+    void logEvent(const TaskEvent& event) {
+        events.append(event);
+        timeline.eventAppended(events);
+    }
+
+    vector<size_t> collectMatches(const string& filter) const {
+        vector<size_t> slots;
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            if (filter == "Show all" ||
+                (filter == "Show completed" && tasks[i].isCompleted()) ||
+                (filter == "Show pending" && !tasks[i].isCompleted())) {
+                slots.push_back(i);
+            }
+        }
+        return slots;
+    }
+
+    // Candidate slots are gathered first so the task records (and their heap-allocated
+    // strings) can be prefetched a few slots ahead of the one being rendered.
+    void renderTasks(const vector<size_t>& slots) const {
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (prefetchDistance > 0 && i + prefetchDistance < slots.size()) {
+                prefetchTask(tasks[slots[i + prefetchDistance]]);
+            }
+            tasks[slots[i]].display(slots[i]);
+        }
+    }
+
+    static void prefetchTask(const Task& task) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(&task);
+        __builtin_prefetch(task.getDescription().data());
+#else
+        (void)task;
+#endif
+    }
+
+    vector<Task> tasks;
+    mutable unordered_map<long long, CachedSlot> slotCache; // Task ID -> slot, empty until first needed
+    vector<SlotEdit> slotEdits;
+    TaskTree tree;
+    size_t prefetchDistance = 8;
+    DescriptionScanner scanner;
+    FuzzyWordIndex fuzzyIndex;
+    DuplicateDetector duplicates;
+    TaskStats stats;
+    EventLog events;
+    TaskTimeline timeline;
+    long long loadedAt = 0; // When the event log was seeded from loaded tasks; 0 if it was not
+    long long nextTaskId = 1;
+    bool dedupeEnabled = false;
+    atomic<uint64_t> generation{0}; // Bumped whenever a task is added, removed or changed; readable without the lock
+    future<vector<vector<size_t>>> nearDuplicateScan;
+    shared_ptr<const DescriptionSnapshot> nearDuplicateSnapshot; // What the last scan saw
+    vector<vector<size_t>> nearDuplicateClusters;                // Last reported, as slots of the snapshot
+    uint64_t nearDuplicateGeneration = 0;
+    TaskHistory history;
+    map<string, size_t> historyCheckpoints; // Name -> undo depth when the checkpoint was set
+    string statePath;
+    string historyPath;
+    string pendingHistoryPath;
+    uint64_t saveSequence = 0;
+    bool loadFailed = false; // The state file exists but could not be read, so it must not be overwritten
+    BlobStore blobs;
+
+    mutex stateMutex;
+    condition_variable retentionWake;
+    thread retentionWorker;
+    bool retentionStopping = false;
+    RetentionPolicy retention;
+    size_t retentionPurged = 0;
+    static const size_t retentionScanSlice = 1024; // Slots scanned per slice of a retention pass
+    static const size_t fuzzyRebuildSlice = 1024;  // Tasks indexed per slice of a fuzzy index rebuild
+
+    mutable SlowOpLog slowOps;
+
+    size_t taskHeapBytes = 0; // Heap bytes owned by the tasks in the list
+    size_t memoryBudget = 0;
+    bool overBudget = false;
+    bool fuzzyIndexEvicted = false;
+    bool fuzzyIndexRebuilding = false; // Evicted, and being rebuilt by the retention worker
+    vector<long long> fuzzyRebuildIds;  // Tasks the rebuild has yet to reach, from fuzzyRebuildNext on
+    size_t fuzzyRebuildNext = 0;
+    size_t evictedIndexBytes = 0; // Size of the fuzzy index when it was evicted
+    MemoryEvictions memoryEvictions;
+
+    static inline const string stateMagicPrefix = "TODO-STATE-"; // Followed by the format version
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// Full-screen task view. Only the rows that fit on the screen are formatted, and each frame is
+// compared with the previous one so only the rows that changed are rewritten. Typing after '/'
+// filters the view as you type; matches appear while the scan is still running.
+class TerminalUi {
+public:
+    explicit TerminalUi(ToDoListManager& manager) : manager(manager) {}
+
+    // Runs until q is pressed. Returns false if stdin is not a terminal.
+    bool run() {
+        if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &savedMode) != 0) {
+            return false;
+        }
+        termios raw = savedMode;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+        writeOut("\x1b[?1049h\x1b[?25l");
+
+        while (true) {
+            bool searching;
+            {
+                unique_lock<mutex> lock = manager.lockForCommand();
+                searching = filterActive() && !manager.advanceSearch(session, filter, searchStepSize);
+                render(searching);
+            }
+            if (searching && !inputPending()) {
+                continue;
+            }
+            int key = readKey();
+            if (key < 0 || (key == 'q' && !editingFilter)) {
+                break;
+            }
+            if (editingFilter) {
+                editFilter(key);
+                continue;
+            }
+            unique_lock<mutex> lock = manager.lockForCommand();
+            handleKey(key, lock);
+        }
+
+        writeOut("\x1b[?25h\x1b[?1049l");
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &savedMode);
+        return true;
+    }
+
+private:
+    enum Key { Up = 256, Down, PageUp, PageDown, Home, End, Escape };
+
+    void editFilter(int key) {
+        if (key == '\n' || key == '\r') {
+            editingFilter = false;
+        } else if (key == Escape) {
+            filter.clear();
+            editingFilter = false;
+        } else if (key == 127 || key == 8) {
+            if (!filter.empty()) {
+                filter.pop_back();
+            }
+        } else if (key >= 32 && key < 127) {
+            filter += static_cast<char>(key);
+        }
+        cursor = 0;
+    }
+
+    bool filterActive() const {
+        return editingFilter || !filter.empty();
+    }
+
+    size_t viewSize() const {
+        return filterActive() ? session.getMatches().size() : manager.getTaskCount();
+    }
+
+    size_t slotAt(size_t row) const {
+        return filterActive() ? session.getMatches()[row] : row;
+    }
+
+    // True if the matches on screen still refer to the current list. Otherwise they are found
+    // again before the next frame, and a key acting on the task under the cursor is ignored,
+    // since the slot it shows may now hold another task.
+    bool matchesCurrent() {
+        if (!filterActive() || session.getGeneration() == manager.getGeneration()) {
+            return true;
+        }
+        status = "The list changed; try again.";
+        return false;
+    }
+
+    // Called with the command lock held through lock; it is released while prompting.
+    void handleKey(int key, unique_lock<mutex>& lock) {
+        size_t count = viewSize();
+        size_t page = max<size_t>(1, listRows());
+        switch (key) {
+            case 'k':
+            case Up:
+                cursor = cursor > 0 ? cursor - 1 : 0;
+                break;
+            case 'j':
+            case Down:
+                ++cursor;
+                break;
+            case PageUp:
+                cursor = cursor > page ? cursor - page : 0;
+                break;
+            case PageDown:
+                cursor += page;
+                break;
+            case 'g':
+            case Home:
+                cursor = 0;
+                break;
+            case 'G':
+            case End:
+                cursor = count;
+                break;
+            case ' ':
+                if (cursor < count && matchesCurrent()) {
+                    int slot = static_cast<int>(slotAt(cursor));
+                    if (manager.taskAt(slot).isCompleted()) {
+                        runCommand([&] { manager.markTaskPending(slot); });
+                    } else {
+                        runCommand([&] { manager.markTaskCompleted(slot); });
+                    }
+                }
+                break;
+            case 'd':
+                if (cursor < count && matchesCurrent()) {
+                    int slot = static_cast<int>(slotAt(cursor));
+                    runCommand([&] { manager.deleteTask(slot); });
+                    status = "Deleted.";
+                }
+                break;
+            case '/':
+                editingFilter = true;
+                cursor = 0;
+                break;
+            case Escape:
+                filter.clear();
+                break;
+            case 'u':
+                runCommand([&] { manager.undo(); });
+                break;
+            case 'r':
+                runCommand([&] { manager.redo(); });
+                break;
+            case 'a': {
+                string description;
+                lock.unlock();
+                bool entered = prompt("New task: ", description);
+                lock.lock();
+                if (entered && !description.empty()) {
+                    bool added = false;
+                    runCommand([&] { added = manager.addTask(Task::Builder(description).build()); });
+                    status = added ? "Task added." : "Not added: duplicate task.";
+                    if (!filterActive()) {
+                        cursor = manager.getTaskCount() - 1;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    // Runs a manager command, showing the last line it prints in the status row instead of
+    // letting it scroll the screen.
+    template <typename Command>
+    void runCommand(Command command) {
+        ostringstream captured;
+        streambuf* original = cout.rdbuf(captured.rdbuf());
+        command();
+        cout.rdbuf(original);
+        string text = captured.str();
+        while (!text.empty() && text.back() == '\n') {
+            text.pop_back();
+        }
+        status = text.substr(text.find_last_of('\n') == string::npos ? 0 : text.find_last_of('\n') + 1);
+    }
+
+    // Reads a line of input on the status row. Returns false if Escape cancels it.
+    bool prompt(const string& label, string& text) {
+        while (true) {
+            drawStatus(label + text);
+            int key = readKey();
+            if (key == '\n' || key == '\r') {
+                return true;
+            }
+            if (key == Escape || key < 0) {
+                return false;
+            }
+            if ((key == 127 || key == 8) && !text.empty()) {
+                text.pop_back();
+            } else if (key >= 32 && key < 127) {
+                text += static_cast<char>(key);
+            }
+        }
+    }
+
+    int readKey() {
+        char byte;
+        if (read(STDIN_FILENO, &byte, 1) != 1) {
+            return -1;
+        }
+        if (byte != '\x1b') {
+            return static_cast<unsigned char>(byte);
+        }
+        // An escape sequence arrives all at once; a lone Escape is followed by nothing.
+        char sequence[3] = {0, 0, 0};
+        pollfd input = {STDIN_FILENO, POLLIN, 0};
+        for (int i = 0; i < 3 && poll(&input, 1, 10) > 0; ++i) {
+            if (read(STDIN_FILENO, &sequence[i], 1) != 1 || (i > 0 && !isdigit(sequence[i]))) {
+                break;
+            }
+        }
+        if (sequence[0] != '[') {
+            return Escape;
+        }
+        switch (sequence[1]) {
+            case 'A': return Up;
+            case 'B': return Down;
+            case 'H': return Home;
+            case 'F': return End;
+            case '5': return PageUp;
+            case '6': return PageDown;
+        }
+        return Escape;
+    }
+
+    bool inputPending() const {
+        pollfd input = {STDIN_FILENO, POLLIN, 0};
+        return poll(&input, 1, 0) > 0;
+    }
+
+    // While a search is still running the match count only grows, so the cursor is clamped
+    // only once it is complete.
+    void render(bool searching) {
+        winsize size;
+        size_t rows = 24, columns = 80;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+            rows = size.ws_row;
+            columns = size.ws_col;
+        }
+        string output;
+        if (rows != screenRows || columns != screenColumns) {
+            screenRows = rows;
+            screenColumns = columns;
+            previous.assign(rows, string());
+            output += "\x1b[2J";
+        }
+
+        size_t count = viewSize();
+        if (!searching) {
+            cursor = count == 0 ? 0 : min(cursor, count - 1);
+        }
+        size_t visible = listRows();
+        if (cursor < top) {
+            top = cursor;
+        } else if (cursor >= top + visible) {
+            top = cursor - visible + 1;
+        }
+
+        vector<string> frame(rows);
+        string header = filterActive() ? to_string(count) + " matching \"" + filter + "\"" + (searching ? " (searching...)" : "")
+                                       : to_string(count) + " tasks";
+        header += "   j/k move  space toggle  d delete  u/r undo/redo  a add  / filter  q quit";
+        frame[0] = "\x1b[1m" + fit(header) + "\x1b[0m";
+        for (size_t row = 0; row < visible && top + row < count; ++row) {
+            size_t slot = slotAt(top + row);
+            string line = fit(manager.taskAt(slot).summary(static_cast<int>(slot)));
+            frame[row + 1] = top + row == cursor ? "\x1b[7m" + line + "\x1b[0m" : line;
+        }
+        frame[rows - 1] = fit(editingFilter ? "/" + filter : status);
+
+        for (size_t row = 0; row < rows; ++row) {
+            if (frame[row] != previous[row]) {
+                output += "\x1b[" + to_string(row + 1) + ";1H" + frame[row] + "\x1b[K";
+            }
+        }
+        previous.swap(frame);
+        writeOut(output);
+    }
+
+    void drawStatus(const string& text) {
+        previous[screenRows - 1] = fit(text);
+        writeOut("\x1b[" + to_string(screenRows) + ";1H" + previous[screenRows - 1] + "\x1b[K");
+    }
+
+    size_t listRows() const {
+        return screenRows > 2 ? screenRows - 2 : 1;
+    }
+
+    string fit(const string& text) const {
+        return text.size() > screenColumns ? text.substr(0, screenColumns) : text;
+    }
+
+    static void writeOut(const string& text) {
+        size_t written = 0;
+        while (written < text.size()) {
+            ssize_t result = write(STDOUT_FILENO, text.data() + written, text.size() - written);
+            if (result <= 0) {
+                return;
+            }
+            written += static_cast<size_t>(result);
+        }
+    }
+
+    ToDoListManager& manager;
+    termios savedMode;
+    vector<string> previous; // The rows currently on screen
+    size_t screenRows = 0;
+    size_t screenColumns = 0;
+    size_t top = 0;
+    size_t cursor = 0; // Row in the current view, not a task slot
+    string status;
+    SearchSession session;
+    string filter;
+    bool editingFilter = false;
+    static const size_t searchStepSize = 16384;
+};
+#endif
+
+// Hardware counters read around a block of code through perf_event_open. Each counter is opened
+// on its own, so one the kernel or CPU cannot provide is left out of the report rather than
+// disabling the rest; counts are scaled up when the kernel had to multiplex them.
+class PerfCounters {
+public:
+    PerfCounters() {
+#if defined(__linux__)
+        open("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        open("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        open("l1d_misses", PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D));
+        open("llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        open("branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        open("dtlb_misses", PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_DTLB));
+#else
+        error = "perf_event_open is only available on Linux";
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (const Counter& counter : counters) {
+            close(counter.fd);
+        }
+#endif
+    }
+
+    bool isAvailable() const {
+        return !counters.empty();
+    }
+
+    // Why no counter could be opened, if none could.
+    const string& getError() const {
+        return error;
+    }
+
+    void start() {
+#if defined(__linux__)
+        for (Counter& counter : counters) {
+            ioctl(counter.fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Returns (counter name, count) for every counter that could be read.
+    vector<pair<string, uint64_t>> stop() {
+        vector<pair<string, uint64_t>> results;
+#if defined(__linux__)
+        for (Counter& counter : counters) {
+            ioctl(counter.fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        for (const Counter& counter : counters) {
+            uint64_t values[3]; // value, time enabled, time running
+            if (read(counter.fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+                continue;
+            }
+            double scale = static_cast<double>(values[1]) / static_cast<double>(values[2]);
+            results.emplace_back(counter.name, static_cast<uint64_t>(static_cast<double>(values[0]) * scale));
+        }
+#endif
+        return results;
+    }
+
+private:
+    struct Counter {
+        string name;
+        int fd;
+    };
+
+#if defined(__linux__)
+    static uint64_t cacheEvent(uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    void open(const string& name, uint32_t type, uint64_t config) {
+        perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = type;
+        attributes.config = config;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (fd < 0) {
+            if (error.empty()) {
+                error = name + ": " + strerror(errno);
+            }
+            return;
+        }
+        counters.push_back(Counter{name, fd});
+    }
+#endif
+
+    vector<Counter> counters;
+    string error;
+};
+
+// Discards everything written to it; benchmarks send the task listings here.
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+
+    streamsize xsputn(const char*, streamsize count) override {
+        return count;
+    }
+};
+
+// Quotes text as a JSON string.
+string jsonString(const string& text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+// Times the main manager operations over taskCount tasks and prints the results, with hardware
+// counter totals and per-operation figures where available, as JSON on stdout. taskCount must
+// be at least 1.
+void runBenchmarks(size_t taskCount) {
+    ToDoListManager manager;
+    manager.setHistoryCoalesceWindow(0);
+    size_t sample = max<size_t>(1, taskCount / 10);
+    struct Benchmark {
+        string name;
+        size_t operations;
+        function<void()> body;
+    };
+    vector<Benchmark> benchmarks = {
+        {"add_task", taskCount, [&] {
+             for (size_t i = 0; i < taskCount; ++i) {
+                 manager.addTask(Task::Builder("Benchmark task " + to_string(i) + (i % 7 == 0 ? " urgent" : "")).build());
+             }
+         }},
+        {"view_tasks", 1, [&] { manager.viewTasks("Show all"); }},
+        {"search_tasks", 1, [&] { manager.searchTasks("urgent"); }},
+        {"mark_completed", sample, [&] {
+             for (size_t i = 0; i < sample; ++i) {
+                 manager.markTaskCompleted(static_cast<int>(i * 10 % taskCount));
+             }
+         }},
+        {"undo", sample, [&] {
+             for (size_t i = 0; i < sample; ++i) {
+                 manager.undo();
+             }
+         }},
+        {"delete_task", min<size_t>(sample, 1000), [&] {
+             for (size_t i = 0; i < min<size_t>(sample, 1000); ++i) {
+                 manager.deleteTask(static_cast<int>(manager.getTaskCount() / 2));
+             }
+         }},
+    };
+
+    PerfCounters counters;
+    NullBuffer discard;
+    streambuf* original = cout.rdbuf();
+    string json = "{\"tasks\": " + to_string(taskCount) + ", \"counters_available\": " +
+                  (counters.isAvailable() ? "true" : "false");
+    if (!counters.isAvailable()) {
+        json += ", \"counters_error\": " + jsonString(counters.getError());
+    }
+    json += ", \"benchmarks\": [";
+    for (size_t b = 0; b < benchmarks.size(); ++b) {
+        const Benchmark& benchmark = benchmarks[b];
+        cout.rdbuf(&discard);
+        auto started = chrono::steady_clock::now();
+        counters.start();
+        benchmark.body();
+        vector<pair<string, uint64_t>> counts = counters.stop();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        cout.rdbuf(original);
+
+        char figures[128];
+        snprintf(figures, sizeof(figures), "\"seconds\": %.6f, \"ns_per_op\": %.1f", seconds,
+                 seconds * 1e9 / static_cast<double>(benchmark.operations));
+        json += string(b > 0 ? ", " : "") + "{\"name\": \"" + benchmark.name + "\", \"operations\": " +
+                to_string(benchmark.operations) + ", " + figures + ", \"counters\": {";
+        for (size_t i = 0; i < counts.size(); ++i) {
+            snprintf(figures, sizeof(figures), "%.2f", static_cast<double>(counts[i].second) / static_cast<double>(benchmark.operations));
+            json += string(i > 0 ? ", " : "") + "\"" + counts[i].first + "\": {\"total\": " + to_string(counts[i].second) +
+                    ", \"per_op\": " + figures + "}";
+        }
+        json += "}}";
+    }
+    json += "]}";
+    cout << json << endl;
+}
+
+// Request latencies in power-of-two microsecond buckets; cheap enough to record on every request
+// from any thread, precise enough for percentiles to within a factor of two.
+class LatencyHistogram {
+public:
+    void record(uint64_t micros) {
+        size_t bucket = 0;
+        while (bucket + 1 < buckets.size() && (uint64_t(1) << (bucket + 1)) <= micros) {
+            ++bucket;
+        }
+        buckets[bucket].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        return total.load(memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the given fraction of recorded latencies.
+    uint64_t percentile(double fraction) const {
+        uint64_t wanted = static_cast<uint64_t>(ceil(fraction * static_cast<double>(count())));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+            seen += buckets[bucket].load(memory_order_relaxed);
+            if (seen >= wanted && seen > 0) {
+                return uint64_t(1) << (bucket + 1);
+            }
+        }
+        return 0;
+    }
+
+private:
+    array<atomic<uint64_t>, 40> buckets{};
+    atomic<uint64_t> total{0};
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// The task lists one server process holds. Besides the default list, a list is opened by name
+// the first time a client asks for it and kept in <basePath>-<name>. Each list has its own lock,
+// retention job and memory budget, so one team's list growing large cannot take memory from the
+// others: it gives up its own history, caches and indexes, and then refuses writes.
+class ListRegistry {
+public:
+    ListRegistry(ToDoListManager& defaultList, const string& basePath, size_t memoryBudget = 0)
+        : defaultList(defaultList), basePath(basePath), memoryBudget(memoryBudget) {}
+
+    ListRegistry(const ListRegistry&) = delete;
+    ListRegistry& operator=(const ListRegistry&) = delete;
+
+    // Returns nullptr, with the reason in error, for a name that is not 1 to 64 letters, digits,
+    // '-' or '_', or a list whose saved state cannot be read.
+    ToDoListManager* open(const string& name, string& error) {
+        if (name == defaultName) {
+            return &defaultList;
+        }
+        if (name.empty() || name.size() > 64 ||
+            name.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_") != string::npos) {
+            error = "invalid list name";
+            return nullptr;
+        }
+        lock_guard<mutex> lock(listsMutex);
+        unique_ptr<ToDoListManager>& list = opened[name];
+        if (!list) {
+            list.reset(new ToDoListManager());
+            if (!list->load(basePath + "-" + name)) {
+                opened.erase(name);
+                error = "saved list cannot be read";
+                return nullptr;
+            }
+            {
+                unique_lock<mutex> commandLock = list->lockForCommand();
+                list->setMemoryBudget(memoryBudget);
+            }
+            list->startRetention(chrono::minutes(1));
+        }
+        return list.get();
+    }
+
+    size_t count() {
+        lock_guard<mutex> lock(listsMutex);
+        return opened.size() + 1;
+    }
+
+    // Saves every list, each under its own command lock.
+    bool saveAll() {
+        bool saved = true;
+        auto save = [&saved](ToDoListManager& list) {
+            unique_lock<mutex> commandLock = list.lockForCommand();
+            saved = list.save() && saved;
+        };
+        save(defaultList);
+        lock_guard<mutex> lock(listsMutex);
+        for (auto& entry : opened) {
+            save(*entry.second);
+        }
+        return saved;
+    }
+
+    static constexpr const char* defaultName = "default";
+
+private:
+    ToDoListManager& defaultList;
+    string basePath;
+    size_t memoryBudget;
+    mutex listsMutex;
+    map<string, unique_ptr<ToDoListManager>> opened;
+};
+
+// Bounds on the requests a server accepts before answering "busy" instead of queueing more.
+// Each operation of a MULTI frame counts as one request.
+struct AdmissionLimits {
+    size_t maxInFlight = 256;       // Queued or running, across all connections
+    size_t maxPerConnection = 32;   // Queued or running, for one connection
+    size_t maxFrameOperations = 32; // In one MULTI frame; larger frames are refused
+};
+
+// Serves one manager over a Unix socket with a line protocol; each request line gets exactly
+// one response line, in order, so clients may pipeline. Requests are admitted only while the
+// in-flight limits allow, and are otherwise answered at once with "BUSY <retry after ms>".
+// Admitted requests are applied by a single thread from three lanes: interactive commands
+// first, then normal ones, then bulk jobs. Bulk jobs and MULTI frames run one slice at a time
+// and go back to the head of their lane after each slice, so other work waits for at most one
+// slice. Lanes reorder work between connections only; a connection's own requests apply in the
+// order sent. A SEARCH identical to one already in flight against the same task generation is
+// not run again; it waits for and shares the first one's response. A connection works on the
+// default list until it sends USE; later requests then go to the named list, when the server
+// has a ListRegistry.
+//
+//   USE <list>                  OK | ERR ...            (answered at once, in order)
+//   interactive:
+//   COMPLETE|PENDING <id>       OK | ERR no such task   (the task ID returned by ADD or SEARCH)
+//   UNDO | REDO                 OK <steps applied>
+//   COUNT                       OK <tasks>
+//   BUDGET <bytes>              OK                      (memory budget of the list; 0 for none)
+//   MEMORY                      OK <name>=<value>...    (memory use and evictions of the list)
+//   METRICS                     OK <name>=<value>...
+//   PING                        OK
+//   normal:
+//   ADD <description>           OK <task id> | ERR duplicate | ERR over memory budget
+//   DELETE <id>                 OK | ERR no such task
+//   SEARCH <text>               OK <matches> <first task IDs...>
+//   RETENTION <days> <keep>     OK
+//   MULTI <op>\x1f<op>...        <response>\x1f<response>... | ERR too many operations
+//                               (applied in order; other connections' requests may run between slices)
+//   bulk:
+//   IMPORT <desc>|<desc>|...    OK <tasks added>
+//   PURGE                       OK <tasks purged>   (applies the retention policy)
+class TaskServer {
+public:
+    TaskServer(ToDoListManager& manager, const AdmissionLimits& limits = AdmissionLimits(), ListRegistry* lists = nullptr)
+        : manager(manager), limits(limits), lists(lists) {}
+
+    TaskServer(const TaskServer&) = delete;
+    TaskServer& operator=(const TaskServer&) = delete;
+
+    ~TaskServer() {
+        stop();
+    }
+
+    bool listen(const string& socketPath) {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        strcpy(address.sun_path, socketPath.c_str());
+        unlink(socketPath.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listenFd, 128) != 0) {
+            return false;
+        }
+        path = socketPath;
+        applier = thread([this] { applyLoop(); });
+        acceptor = thread([this] { acceptLoop(); });
+        return true;
+    }
+
+    // Stops accepting, answers everything already admitted, then closes all connections.
+    void stop() {
+        if (!acceptor.joinable()) {
+            return;
+        }
+        stopping = true;
+        acceptor.join();
+        close(listenFd);
+        unlink(path.c_str());
+        {
+            lock_guard<mutex> lock(connectionsMutex);
+            for (const auto& connection : connections) {
+                shutdown(connection->fd, SHUT_RD);
+            }
+        }
+        for (;;) {
+            lock_guard<mutex> lock(connectionsMutex);
+            if (connections.empty()) {
+                break;
+            }
+            reapConnections();
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        {
+            lock_guard<mutex> lock(queueMutex);
+            applierStopping = true;
+        }
+        queueReady.notify_all();
+        applier.join();
+    }
+
+    string metrics() const {
+        static const char* laneNames[] = {"interactive", "normal", "bulk"};
+        string laneMetrics;
+        for (size_t lane = 0; lane < laneCount; ++lane) {
+            const LatencyHistogram& latency = laneLatency[lane];
+            laneMetrics += string(" ") + laneNames[lane] + "_done=" + to_string(latency.count()) + " " + laneNames[lane] +
+                           "_p50_us=" + to_string(latency.percentile(0.5)) + " " + laneNames[lane] +
+                           "_p99_us=" + to_string(latency.percentile(0.99));
+        }
+        return "lists=" + to_string(lists ? lists->count() : 1) + " singleflight_leaders=" + to_string(flightLeaders.load()) +
+               " singleflight_joined=" + to_string(flightJoined.load()) + " in_flight=" + to_string(inFlight.load()) + " queue_depth=" + to_string(queueDepth.load()) +
+               " accepted=" + to_string(accepted.load()) + " completed=" + to_string(completed.load()) +
+               " rejected_global=" + to_string(rejectedGlobal.load()) +
+               " rejected_connection=" + to_string(rejectedConnection.load()) +
+               " service_us_avg=" + to_string(serviceMicros.load()) + " connections=" + to_string(connectionCount.load()) + laneMetrics;
+    }
+
+private:
+    struct Request;
+
+    struct Connection {
+        int fd;
+        ToDoListManager* list; // Set by USE; used by the reader thread only
+        string listName;
+        atomic<size_t> inFlight{0};
+        mutex responsesMutex;
+        condition_variable responsesChanged;
+        deque<shared_future<string>> responses;
+        shared_ptr<Request> lastAdmitted; // Used by the reader thread only
+        bool readerDone = false;
+        atomic<bool> finished{false};
+        thread reader;
+        thread writer;
+    };
+
+    enum Lane { Interactive, Normal, Bulk, laneCount };
+
+    struct Request {
+        string line;
+        promise<string> response;
+        shared_ptr<Connection> connection;
+        ToDoListManager* list;
+        Lane lane;
+        chrono::steady_clock::time_point admitted;
+        shared_ptr<Request> previous; // The connection's request before this one, until it finishes
+        bool finished = false;
+        size_t cost = 1;  // Requests charged against the admission limits
+        string flightKey; // Set when other identical queries may share this one's response
+        // Progress of a bulk job or MULTI frame between slices
+        vector<string> items;
+        size_t nextItem = 0;
+        size_t added = 0;
+        string responses;
+        RetentionSweep sweep;
+    };
+
+    static Lane laneFor(const string& line) {
+        string command = line.substr(0, line.find(' '));
+        if (command == "IMPORT" || command == "PURGE") {
+            return Bulk;
+        }
+        if (command == "ADD" || command == "DELETE" || command == "SEARCH" || command == "RETENTION" || command == "MULTI") {
+            return Normal;
+        }
+        return Interactive;
+    }
+
+    void acceptLoop() {
+        pollfd listening = {listenFd, POLLIN, 0};
+        while (!stopping) {
+            if (poll(&listening, 1, 100) <= 0) {
+                lock_guard<mutex> lock(connectionsMutex);
+                reapConnections();
+                continue;
+            }
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) {
+                continue;
+            }
+            auto connection = make_shared<Connection>();
+            connection->fd = fd;
+            connection->list = &manager;
+            connection->listName = ListRegistry::defaultName;
+            connection->reader = thread([this, connection] { readLoop(connection); });
+            connection->writer = thread([this, connection] { writeLoop(connection); });
+            lock_guard<mutex> lock(connectionsMutex);
+            connections.push_back(connection);
+            ++connectionCount;
+            reapConnections();
+        }
+    }
+
+    // Call with connectionsMutex held.
+    void reapConnections() {
+        for (auto it = connections.begin(); it != connections.end();) {
+            if ((*it)->finished) {
+                (*it)->reader.join();
+                (*it)->writer.join();
+                close((*it)->fd);
+                --connectionCount;
+                it = connections.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void readLoop(shared_ptr<Connection> connection) {
+        string buffered;
+        char chunk[4096];
+        for (;;) {
+            ssize_t count = recv(connection->fd, chunk, sizeof(chunk), 0);
+            if (count <= 0) {
+                break;
+            }
+            buffered.append(chunk, static_cast<size_t>(count));
+            size_t start = 0;
+            for (size_t end; (end = buffered.find('\n', start)) != string::npos; start = end + 1) {
+                string line = buffered.substr(start, end - start);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                submit(connection, line);
+            }
+            buffered.erase(0, start);
+        }
+        lock_guard<mutex> lock(connection->responsesMutex);
+        connection->readerDone = true;
+        connection->responsesChanged.notify_all();
+    }
+
+    // Admits or rejects one request. The reader stops taking requests from a client that does
+    // not read its responses, so the socket buffers push back on it.
+    void submit(const shared_ptr<Connection>& connection, const string& line) {
+        {
+            unique_lock<mutex> lock(connection->responsesMutex);
+            connection->responsesChanged.wait(lock, [&] { return connection->responses.size() < 4 * limits.maxPerConnection; });
+        }
+        if (line.compare(0, 4, "USE ") == 0) {
+            string response = "OK";
+            string error;
+            ToDoListManager* list = lists ? lists->open(line.substr(4), error) : nullptr;
+            if (!lists) {
+                response = "ERR this server has one list";
+            } else if (!list) {
+                response = "ERR " + error;
+            } else {
+                connection->list = list;
+                connection->listName = line.substr(4);
+            }
+            promise<string> ready;
+            ready.set_value(response);
+            lock_guard<mutex> lock(connection->responsesMutex);
+            connection->responses.push_back(ready.get_future().share());
+            connection->responsesChanged.notify_all();
+            return;
+        }
+        // Only a connection with nothing outstanding may share a flight; otherwise the shared
+        // result could miss its own earlier writes.
+        string flightKey;
+        if (line.compare(0, 7, "SEARCH ") == 0 && connection->inFlight == 0) {
+            flightKey = connection->listName + '\0' + toLowerAscii(line.substr(7)) + '\0' +
+                        to_string(connection->list->getGeneration());
+            lock_guard<mutex> lock(flightsMutex);
+            auto flight = flights.find(flightKey);
+            if (flight != flights.end()) {
+                ++flightJoined;
+                connection->lastAdmitted = flight->second.first;
+                shared_future<string> shared = flight->second.second;
+                lock_guard<mutex> responsesLock(connection->responsesMutex);
+                connection->responses.push_back(shared);
+                connection->responsesChanged.notify_all();
+                return;
+            }
+        }
+
+        size_t cost = 1;
+        if (line.compare(0, 6, "MULTI ") == 0) {
+            cost += count(line.begin(), line.end(), multiSeparator);
+        }
+        promise<string> response;
+        shared_future<string> result = response.get_future().share();
+        if (cost > min({limits.maxFrameOperations, limits.maxPerConnection, limits.maxInFlight})) {
+            response.set_value("ERR too many operations");
+        } else if (connection->inFlight + cost > limits.maxPerConnection) {
+            ++rejectedConnection;
+            response.set_value(busyResponse());
+        } else if (inFlight.fetch_add(cost) + cost > limits.maxInFlight) {
+            inFlight -= cost;
+            ++rejectedGlobal;
+            response.set_value(busyResponse());
+        } else {
+            ++accepted;
+            connection->inFlight += cost;
+            auto request = make_shared<Request>();
+            request->line = line;
+            request->cost = cost;
+            request->response = move(response);
+            request->connection = connection;
+            request->list = connection->list;
+            request->lane = laneFor(line);
+            request->admitted = chrono::steady_clock::now();
+            request->previous = connection->lastAdmitted;
+            connection->lastAdmitted = request;
+            if (!flightKey.empty()) {
+                lock_guard<mutex> lock(flightsMutex);
+                if (flights.emplace(flightKey, make_pair(request, result)).second) {
+                    request->flightKey = flightKey;
+                    ++flightLeaders;
+                }
+            }
+            {
+                lock_guard<mutex> lock(queueMutex);
+                lanes[request->lane].push_back(request);
+                ++queueDepth;
+            }
+            queueReady.notify_one();
+        }
+        lock_guard<mutex> lock(connection->responsesMutex);
+        connection->responses.push_back(result);
+        connection->responsesChanged.notify_all();
+    }
+
+    // How long a rejected client should wait: the time the applier needs for the queue ahead.
+    string busyResponse() const {
+        uint64_t wait = max<uint64_t>(1, queueDepth.load() * max<uint64_t>(1, serviceMicros.load()) / 1000);
+        return "BUSY " + to_string(wait);
+    }
+
+    void writeLoop(shared_ptr<Connection> connection) {
+        bool writable = true;
+        for (;;) {
+            shared_future<string> next;
+            {
+                unique_lock<mutex> lock(connection->responsesMutex);
+                connection->responsesChanged.wait(lock, [&] { return !connection->responses.empty() || connection->readerDone; });
+                if (connection->responses.empty()) {
+                    break;
+                }
+                next = connection->responses.front();
+            }
+            string line = next.get() + "\n";
+            for (size_t sent = 0; writable && sent < line.size();) {
+                ssize_t count = send(connection->fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+                if (count <= 0) {
+                    writable = false;
+                    shutdown(connection->fd, SHUT_RD);
+                }
+                sent += count > 0 ? static_cast<size_t>(count) : 0;
+            }
+            lock_guard<mutex> lock(connection->responsesMutex);
+            connection->responses.pop_front();
+            connection->responsesChanged.notify_all();
+        }
+        connection->finished = true;
+    }
+
+    void applyLoop() {
+        for (;;) {
+            shared_ptr<Request> request;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueReady.wait(lock, [this] { return queueDepth > 0 || applierStopping; });
+                if (queueDepth == 0) {
+                    return;
+                }
+                request = takeNextRequest();
+                --queueDepth;
+            }
+            auto started = chrono::steady_clock::now();
+            string response;
+            bool done = true;
+            if (request->lane == Bulk || request->line.compare(0, 6, "MULTI ") == 0) {
+                done = executeSlice(*request, response);
+            } else {
+                response = execute(*request->list, request->line);
+            }
+            uint64_t micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
+            serviceMicros = (serviceMicros.load() * 7 + micros) / 8;
+            if (!done) {
+                lock_guard<mutex> lock(queueMutex);
+                lanes[request->lane].push_front(request);
+                ++queueDepth;
+                continue;
+            }
+            if (!request->flightKey.empty()) {
+                lock_guard<mutex> lock(flightsMutex);
+                flights.erase(request->flightKey);
+            }
+            request->finished = true;
+            request->previous.reset();
+            laneLatency[request->lane].record(
+                chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - request->admitted).count());
+            request->connection->inFlight -= request->cost;
+            inFlight -= request->cost;
+            ++completed;
+            request->response.set_value(response);
+        }
+    }
+
+    // The first request, by lane priority and then age, whose connection has nothing earlier
+    // still outstanding. The oldest request of each connection always qualifies. Call with
+    // queueMutex held and at least one request queued.
+    shared_ptr<Request> takeNextRequest() {
+        for (auto& lane : lanes) {
+            for (auto it = lane.begin(); it != lane.end(); ++it) {
+                if (!(*it)->previous || (*it)->previous->finished) {
+                    shared_ptr<Request> request = *it;
+                    lane.erase(it);
+                    return request;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // Runs one slice of a bulk job or MULTI frame; returns true with the response once it is
+    // finished.
+    bool executeSlice(Request& request, string& response) {
+        size_t space = request.line.find(' ');
+        string command = request.line.substr(0, space);
+        if ((command == "IMPORT" || command == "MULTI") && request.nextItem == 0 && request.items.empty()) {
+            string list = space == string::npos ? string() : request.line.substr(space + 1);
+            char separator = command == "MULTI" ? multiSeparator : '|';
+            for (size_t start = 0; start <= list.size();) {
+                size_t end = list.find(separator, start);
+                end = end == string::npos ? list.size() : end;
+                if (end > start || command == "MULTI") {
+                    request.items.push_back(list.substr(start, end - start));
+                }
+                start = end + 1;
+            }
+        }
+
+        ToDoListManager& manager = *request.list;
+        unique_lock<mutex> lock = manager.lockForCommand();
+        if (command == "PURGE") {
+            if (!manager.advanceRetention(request.sweep)) {
+                return false;
+            }
+            response = "OK " + to_string(request.sweep.purged);
+            return true;
+        }
+        if (command == "MULTI") {
+            size_t end = min(request.items.size(), request.nextItem + multiSliceSize);
+            for (; request.nextItem < end; ++request.nextItem) {
+                const string& operation = request.items[request.nextItem];
+                size_t operationSpace = operation.find(' ');
+                string operationCommand = operation.substr(0, operationSpace);
+                string operationArgument = operationSpace == string::npos ? string() : operation.substr(operationSpace + 1);
+                if (request.nextItem > 0) {
+                    request.responses += multiSeparator;
+                }
+                request.responses +=
+                    operationCommand == "MULTI" ? "ERR nested MULTI" : executeLocked(manager, operationCommand, operationArgument);
+            }
+            if (request.nextItem < request.items.size()) {
+                return false;
+            }
+            response = move(request.responses);
+            return true;
+        }
+        size_t end = min(request.items.size(), request.nextItem + bulkSliceSize);
+        for (; request.nextItem < end; ++request.nextItem) {
+            request.added += manager.addTask(Task::Builder(request.items[request.nextItem]).build()) ? 1 : 0;
+        }
+        if (request.nextItem < request.items.size()) {
+            return false;
+        }
+        response = "OK " + to_string(request.added);
+        return true;
+    }
+
+    string execute(ToDoListManager& manager, const string& line) {
+        size_t space = line.find(' ');
+        string command = line.substr(0, space);
+        string argument = space == string::npos ? string() : line.substr(space + 1);
+        if (command == "PING") {
+            return "OK";
+        }
+        if (command == "METRICS") {
+            string listMetrics;
+            {
+                unique_lock<mutex> lock = manager.lockForCommand();
+                listMetrics = " tasks=" + to_string(manager.getTaskCount()) + " " + manager.memoryMetrics();
+            }
+            return "OK " + metrics() + listMetrics;
+        }
+
+        unique_lock<mutex> lock = manager.lockForCommand();
+        return executeLocked(manager, command, argument);
+    }
+
+    // Call with the list's command lock held.
+    static string executeLocked(ToDoListManager& manager, const string& command, const string& argument) {
+        if (command == "ADD") {
+            if (argument.empty()) {
+                return "ERR missing description";
+            }
+            if (!manager.addTask(Task::Builder(argument).build())) {
+                return manager.isOverMemoryBudget() ? "ERR over memory budget" : "ERR duplicate";
+            }
+            return "OK " + to_string(manager.taskAt(manager.getTaskCount() - 1).getId());
+        }
+        // Tasks are named by ID, not position, so a request still reaches the task the client
+        // meant after other clients have added or removed tasks ahead of it.
+        if (command == "COMPLETE" || command == "PENDING" || command == "DELETE") {
+            char* end;
+            long long taskId = strtoll(argument.c_str(), &end, 10);
+            int slot = argument.empty() || *end != '\0' ? -1 : manager.slotOfTask(taskId);
+            if (slot < 0) {
+                return "ERR no such task";
+            }
+            if (command == "COMPLETE") {
+                manager.markTaskCompleted(slot);
+            } else if (command == "PENDING") {
+                manager.markTaskPending(slot);
+            } else {
+                manager.deleteTask(slot);
+            }
+            return "OK";
+        }
+        if (command == "SEARCH") {
+            vector<size_t> slots = manager.findTasks(argument);
+            string response = "OK " + to_string(slots.size());
+            for (size_t i = 0; i < slots.size() && i < 20; ++i) {
+                response += " " + to_string(manager.taskAt(slots[i]).getId());
+            }
+            return response;
+        }
+        if (command == "COUNT") {
+            return "OK " + to_string(manager.getTaskCount());
+        }
+        if (command == "RETENTION") {
+            long long days, keep;
+            istringstream fields(argument);
+            if (!(fields >> days >> keep) || days < 0 || keep < 0) {
+                return "ERR expected days and count";
+            }
+            RetentionPolicy policy;
+            policy.maxCompletedAgeDays = days;
+            policy.maxCompletedKept = static_cast<size_t>(keep);
+            manager.setRetentionPolicy(policy);
+            return "OK";
+        }
+        if (command == "BUDGET") {
+            char* end;
+            unsigned long long bytes = strtoull(argument.c_str(), &end, 10);
+            if (argument.empty() || *end != '\0') {
+                return "ERR expected bytes";
+            }
+            manager.setMemoryBudget(bytes);
+            return "OK";
+        }
+        if (command == "MEMORY") {
+            return "OK " + manager.memoryMetrics();
+        }
+        if (command == "UNDO") {
+            return "OK " + to_string(manager.applyUndo(1));
+        }
+        if (command == "REDO") {
+            return "OK " + to_string(manager.applyRedo(1));
+        }
+        return "ERR unknown command";
+    }
+
+    ToDoListManager& manager;
+    AdmissionLimits limits;
+    ListRegistry* lists;
+    string path;
+    int listenFd = -1;
+    atomic<bool> stopping{false};
+    thread acceptor;
+    thread applier;
+
+    mutex connectionsMutex;
+    list<shared_ptr<Connection>> connections;
+
+    mutex queueMutex;
+    condition_variable queueReady;
+    array<deque<shared_ptr<Request>>, laneCount> lanes;
+    bool applierStopping = false;
+    static const size_t bulkSliceSize = 64;
+    static const size_t multiSliceSize = 8; // MULTI operations applied per slice
+    array<LatencyHistogram, laneCount> laneLatency;
+
+    static constexpr char multiSeparator = '\x1f';
+
+    mutex flightsMutex;
+    unordered_map<string, pair<shared_ptr<Request>, shared_future<string>>> flights; // Key -> leader and its result
+    atomic<uint64_t> flightLeaders{0};
+    atomic<uint64_t> flightJoined{0};
+
+    atomic<size_t> inFlight{0};
+    atomic<size_t> queueDepth{0};
+    atomic<size_t> connectionCount{0};
+    atomic<uint64_t> accepted{0};
+    atomic<uint64_t> completed{0};
+    atomic<uint64_t> rejectedGlobal{0};
+    atomic<uint64_t> rejectedConnection{0};
+    atomic<uint64_t> serviceMicros{0}; // Moving average of the time to apply one request
+};
+
+// Opens a client connection to a task server; returns -1 on failure.
+int connectToServer(const string& socketPath) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Client for a task server. Requests are spread over a pool of connections and pipelined: each
+// connection keeps up to pipelineDepth requests outstanding and a reader thread matches the
+// response lines to them in order. Mutations passed to mutate() are collected into MULTI frames
+// of up to maxBatch operations, sent when a frame fills, when flush() is called, or after a
+// short delay. Every call returns a future of the server's response line; BUSY responses are
+// returned as they are, for the caller to retry. A connection the server has closed is replaced
+// the next time a request is sent.
+class TaskClient {
+public:
+    TaskClient(const string& socketPath, size_t poolSize = 2, size_t pipelineDepth = 16, size_t maxBatch = 32)
+        : socketPath(socketPath), pipelineDepth(max<size_t>(1, pipelineDepth)), maxBatch(max<size_t>(1, maxBatch)) {
+        for (size_t i = 0; i < poolSize; ++i) {
+            shared_ptr<Connection> connection = openConnection();
+            if (connection) {
+                pool.push_back(connection);
+            }
+        }
+        flusher = thread([this] { flushLoop(); });
+    }
+
+    TaskClient(const TaskClient&) = delete;
+    TaskClient& operator=(const TaskClient&) = delete;
+
+    ~TaskClient() {
+        flush();
+        {
+            lock_guard<mutex> lock(batchMutex);
+            closing = true;
+        }
+        batchReady.notify_all();
+        flusher.join();
+        for (const auto& connection : pool) {
+            shutdown(connection->fd, SHUT_RDWR);
+            connection->reader.join();
+        }
+    }
+
+    bool isConnected() const {
+        lock_guard<mutex> lock(poolMutex);
+        return !pool.empty();
+    }
+
+    future<string> request(const string& line) {
+        Pending pending;
+        future<string> result = pending.single.get_future();
+        sendFrame(sanitize(line), move(pending));
+        return result;
+    }
+
+    // Like request(), but the operation may travel to the server in one frame with others.
+    future<string> mutate(const string& line) {
+        unique_lock<mutex> lock(batchMutex);
+        batch.emplace_back();
+        future<string> result = batch.back().get_future();
+        batchFrame += (batchFrame.empty() ? "MULTI " : string(1, '\x1f')) + sanitize(line);
+        if (batch.size() >= maxBatch) {
+            sendBatch(lock);
+        } else if (batch.size() == 1) {
+            batchReady.notify_one();
+        }
+        return result;
+    }
+
+    void flush() {
+        unique_lock<mutex> lock(batchMutex);
+        sendBatch(lock);
+    }
+
+    string call(const string& line) {
+        return request(line).get();
+    }
+
+private:
+    struct Pending {
+        promise<string> single;
+        vector<promise<string>> batch; // Set for a MULTI frame, one per operation
+    };
+
+    // Closes its socket when the last sender holding it lets go, so a replaced connection's
+    // descriptor is never reused under a send still in progress.
+    struct Connection {
+        ~Connection() {
+            close(fd);
+        }
+
+        int fd;
+        mutex writeMutex; // Keeps the order of frames on the wire equal to the order in pending
+        mutex pendingMutex;
+        condition_variable pendingChanged;
+        deque<Pending> pending;
+        bool broken = false; // Set by the reader when it stops
+        thread reader;
+    };
+
+    shared_ptr<Connection> openConnection() {
+        int fd = connectToServer(socketPath);
+        if (fd < 0) {
+            return nullptr;
+        }
+        auto connection = make_shared<Connection>();
+        connection->fd = fd;
+        connection->reader = thread([this, connection] { readLoop(*connection); });
+        return connection;
+    }
+
+    // Call with poolMutex held. Replaces a broken connection with a new one; returns false and
+    // leaves it in place if the server cannot be reached.
+    bool reconnect(shared_ptr<Connection>& connection) {
+        shared_ptr<Connection> replacement = openConnection();
+        if (!replacement) {
+            return false;
+        }
+        connection->reader.join();
+        connection = replacement;
+        return true;
+    }
+
+    // Newlines would end the request early and 0x1f would split a MULTI frame.
+    static string sanitize(string line) {
+        replace_if(line.begin(), line.end(), [](char c) { return c == '\n' || c == '\r' || c == '\x1f'; }, ' ');
+        return line;
+    }
+
+    // Call with batchMutex held through lock; it is released while the frame is sent.
+    void sendBatch(unique_lock<mutex>& lock) {
+        if (batch.empty()) {
+            return;
+        }
+        Pending pending;
+        pending.batch = move(batch);
+        string frame = move(batchFrame);
+        batch.clear();
+        batchFrame.clear();
+        lock.unlock();
+        sendFrame(frame, move(pending));
+        lock.lock();
+    }
+
+    void flushLoop() {
+        unique_lock<mutex> lock(batchMutex);
+        while (!closing) {
+            if (batch.empty()) {
+                batchReady.wait(lock);
+                continue;
+            }
+            batchReady.wait_for(lock, batchDelay);
+            sendBatch(lock);
+        }
+    }
+
+    static void fail(Pending& pending, const string& response) {
+        if (pending.batch.empty()) {
+            pending.single.set_value(response);
+        }
+        for (promise<string>& operation : pending.batch) {
+            operation.set_value(response);
+        }
+    }
+
+    // Sends on the connection with the fewest outstanding requests, waiting while it is full.
+    // Broken connections are reconnected first, or passed over if that fails.
+    void sendFrame(const string& frame, Pending pending) {
+        shared_ptr<Connection> connection;
+        {
+            lock_guard<mutex> poolLock(poolMutex);
+            if (pool.empty()) {
+                fail(pending, "ERR not connected");
+                return;
+            }
+            size_t fewest = numeric_limits<size_t>::max();
+            for (size_t i = 0, first = nextConnection++; i < pool.size(); ++i) {
+                shared_ptr<Connection>& candidate = pool[(first + i) % pool.size()];
+                bool broken;
+                {
+                    lock_guard<mutex> lock(candidate->pendingMutex);
+                    broken = candidate->broken;
+                }
+                if (broken && !reconnect(candidate)) {
+                    continue;
+                }
+                lock_guard<mutex> lock(candidate->pendingMutex);
+                if (candidate->pending.size() < fewest) {
+                    fewest = candidate->pending.size();
+                    connection = candidate;
+                }
+            }
+        }
+        if (!connection) {
+            fail(pending, "ERR disconnected");
+            return;
+        }
+
+        lock_guard<mutex> writeLock(connection->writeMutex);
+        {
+            unique_lock<mutex> lock(connection->pendingMutex);
+            connection->pendingChanged.wait(lock, [&] { return connection->pending.size() < pipelineDepth || connection->broken; });
+            if (connection->broken) {
+                fail(pending, "ERR disconnected");
+                return;
+            }
+            connection->pending.push_back(move(pending));
+        }
+        string line = frame + "\n";
+        for (size_t sent = 0; sent < line.size();) {
+            ssize_t count = send(connection->fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+            if (count <= 0) {
+                shutdown(connection->fd, SHUT_RDWR); // The reader fails everything outstanding
+                return;
+            }
+            sent += static_cast<size_t>(count);
+        }
+    }
+
+    void readLoop(Connection& connection) {
+        string buffered;
+        char chunk[16384];
+        for (;;) {
+            size_t newline = buffered.find('\n');
+            if (newline == string::npos) {
+                ssize_t count = recv(connection.fd, chunk, sizeof(chunk), 0);
+                if (count <= 0) {
+                    break;
+                }
+                buffered.append(chunk, static_cast<size_t>(count));
+                continue;
+            }
+            string response = buffered.substr(0, newline);
+            buffered.erase(0, newline + 1);
+
+            Pending pending;
+            {
+                lock_guard<mutex> lock(connection.pendingMutex);
+                if (connection.pending.empty()) {
+                    continue;
+                }
+                pending = move(connection.pending.front());
+                connection.pending.pop_front();
+            }
+            connection.pendingChanged.notify_all();
+            if (pending.batch.empty()) {
+                pending.single.set_value(response);
+            } else if (response.find('\x1f') == string::npos && pending.batch.size() > 1) {
+                fail(pending, response); // The whole frame was turned away, e.g. BUSY
+            } else {
+                size_t start = 0;
+                for (promise<string>& operation : pending.batch) {
+                    size_t end = min(response.find('\x1f', start), response.size());
+                    operation.set_value(start <= response.size() ? response.substr(start, end - start) : "ERR missing response");
+                    start = end + 1;
+                }
+            }
+        }
+
+        lock_guard<mutex> lock(connection.pendingMutex);
+        connection.broken = true;
+        for (Pending& pending : connection.pending) {
+            fail(pending, "ERR disconnected");
+        }
+        connection.pending.clear();
+        connection.pendingChanged.notify_all();
+    }
+
+    string socketPath;
+    size_t pipelineDepth;
+    size_t maxBatch;
+    static constexpr chrono::microseconds batchDelay{200};
+    mutable mutex poolMutex;
+    vector<shared_ptr<Connection>> pool;
+    size_t nextConnection = 0;
+
+    mutex batchMutex;
+    condition_variable batchReady;
+    vector<promise<string>> batch;
+    string batchFrame;
+    bool closing = false;
+    thread flusher;
+};
+
+// Measures requests per second through a TaskClient against an in-process server for a range
+// of pipeline depths, once with single requests and once with mutations batched into frames.
+void runClientBenchmark() {
+    ToDoListManager manager;
+    manager.setHistoryCoalesceWindow(0);
+    for (size_t i = 0; i < 20000; ++i) {
+        manager.addTask(Task::Builder("Client benchmark task " + to_string(i)).build());
+    }
+    AdmissionLimits limits;
+    limits.maxInFlight = limits.maxPerConnection = 32 * 32; // Up to 32 frames of 32 operations
+    TaskServer server(manager, limits);
+    string socketPath = "/tmp/todo-client-" + to_string(getpid()) + ".sock";
+    if (!server.listen(socketPath)) {
+        cerr << "Could not listen on " << socketPath << endl;
+        return;
+    }
+
+    cout << "depth  requests/s  batched requests/s" << endl;
+    for (size_t depth : {1, 2, 4, 8, 16, 32}) {
+        double rates[2];
+        for (int batched = 0; batched < 2; ++batched) {
+            TaskClient client(socketPath, 1, depth, 32);
+            deque<future<string>> outstanding;
+            size_t operations = 0;
+            auto started = chrono::steady_clock::now();
+            auto deadline = started + chrono::milliseconds(500);
+            while (chrono::steady_clock::now() < deadline) {
+                for (size_t i = 0; i < 256; ++i, ++operations) {
+                    if (outstanding.size() >= (batched ? depth * 32 : depth)) {
+                        outstanding.front().get();
+                        outstanding.pop_front();
+                    }
+                    // The tasks added above have IDs 1 to 20000.
+                    string operation = (operations % 2 ? "PENDING " : "COMPLETE ") + to_string(operations / 2 % 20000 + 1);
+                    outstanding.push_back(batched ? client.mutate(operation) : client.request(operation));
+                }
+            }
+            client.flush();
+            for (future<string>& response : outstanding) {
+                response.get();
+            }
+            rates[batched] = operations / chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        }
+        char row[64];
+        snprintf(row, sizeof(row), "%-6zu %-11.0f %.0f", depth, rates[0], rates[1]);
+        cout << row << endl;
+    }
+}
+
+atomic<bool> serverInterrupted{false};
+
+// Serves the tasks saved under basePath, and any other lists clients open, until SIGINT or
+// SIGTERM, then saves them all. Every list gets memoryBudget bytes; 0 means no limit.
+int runServer(const string& socketPath, const string& basePath, size_t memoryBudget) {
+    ToDoListManager manager;
+    if (!manager.load(basePath)) {
+        cerr << "Could not read " << basePath << ".tasks; not serving, so it is not overwritten." << endl;
+        return 1;
+    }
+    {
+        unique_lock<mutex> lock = manager.lockForCommand();
+        manager.setMemoryBudget(memoryBudget);
+    }
+    manager.startRetention(chrono::minutes(1));
+    ListRegistry lists(manager, basePath, memoryBudget);
+    TaskServer server(manager, AdmissionLimits(), &lists);
+    if (!server.listen(socketPath)) {
+        cerr << "Could not listen on " << socketPath << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    signal(SIGINT, [](int) { serverInterrupted = true; });
+    signal(SIGTERM, [](int) { serverInterrupted = true; });
+    cout << "Serving on " << socketPath << endl;
+    while (!serverInterrupted) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+    server.stop();
+    cout << server.metrics() << endl;
+    return lists.saveAll() ? 0 : 1;
+}
+
+// One closed-loop load-test client: sends makeRequest(i) and waits for its response until
+// running turns false. A BUSY response is followed by the suggested wait. Latencies of served
+// requests are appended to latencies and rejections counted in busy.
+template <typename MakeRequest>
+void runLoadClient(const string& socketPath, const atomic<bool>& running, MakeRequest makeRequest, mutex& resultsMutex,
+                   vector<uint64_t>& latencies, uint64_t& busy) {
+    int fd = connectToServer(socketPath);
+    if (fd < 0) {
+        return;
+    }
+    vector<uint64_t> mine;
+    uint64_t rejected = 0;
+    string buffered;
+    char chunk[4096];
+    for (size_t i = 0; running; ++i) {
+        string request = makeRequest(i) + "\n";
+        auto started = chrono::steady_clock::now();
+        if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+            break;
+        }
+        size_t newline;
+        while ((newline = buffered.find('\n')) == string::npos) {
+            ssize_t count = recv(fd, chunk, sizeof(chunk), 0);
+            if (count <= 0) {
+                break;
+            }
+            buffered.append(chunk, static_cast<size_t>(count));
+        }
+        if (newline == string::npos) {
+            break;
+        }
+        string response = buffered.substr(0, newline);
+        buffered.erase(0, newline + 1);
+        if (response.compare(0, 5, "BUSY ") == 0) {
+            ++rejected;
+            this_thread::sleep_for(chrono::milliseconds(atoll(response.c_str() + 5)));
+        } else {
+            mine.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count());
+        }
+    }
+    close(fd);
+    lock_guard<mutex> lock(resultsMutex);
+    latencies.insert(latencies.end(), mine.begin(), mine.end());
+    busy += rejected;
+}
+
+// Drives an in-process server with a growing number of closed-loop clients and prints, for each
+// client count, throughput, latency percentiles of the requests that were served and the share
+// that was turned away. Then measures interactive latency while bulk imports run alongside.
+void runLoadTest() {
+    ToDoListManager manager;
+    manager.setHistoryCoalesceWindow(0);
+    for (size_t i = 0; i < 20000; ++i) {
+        manager.addTask(Task::Builder("Load test task " + to_string(i)).build());
+    }
+    AdmissionLimits limits;
+    limits.maxInFlight = 16;
+    limits.maxPerConnection = 4;
+    TaskServer server(manager, limits);
+    string socketPath = "/tmp/todo-load-" + to_string(getpid()) + ".sock";
+    if (!server.listen(socketPath)) {
+        cerr << "Could not listen on " << socketPath << endl;
+        return;
+    }
+
+    auto percentile = [](const vector<uint64_t>& sorted, double fraction) {
+        return sorted.empty() ? 0 : sorted[min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+    };
+    cout << "clients  ops/s     p50_us   p99_us   busy%" << endl;
+    for (size_t clients : {1, 2, 4, 8, 16, 32, 64}) {
+        atomic<bool> running{true};
+        mutex resultsMutex;
+        vector<uint64_t> latencies;
+        uint64_t busy = 0;
+        vector<thread> threads;
+        for (size_t c = 0; c < clients; ++c) {
+            threads.emplace_back([&, c] {
+                runLoadClient(socketPath, running, [c](size_t i) {
+                    return i % 5 == 0 ? "ADD client " + to_string(c) + " item " + to_string(i) : string("SEARCH task 9");
+                }, resultsMutex, latencies, busy);
+            });
+        }
+        this_thread::sleep_for(chrono::seconds(1));
+        running = false;
+        for (thread& t : threads) {
+            t.join();
+        }
+        sort(latencies.begin(), latencies.end());
+        char row[96];
+        snprintf(row, sizeof(row), "%-8zu %-9zu %-8llu %-8llu %.1f", clients, latencies.size(),
+                 static_cast<unsigned long long>(percentile(latencies, 0.5)),
+                 static_cast<unsigned long long>(percentile(latencies, 0.99)),
+                 100.0 * busy / max<size_t>(1, busy + latencies.size()));
+        cout << row << endl;
+    }
+
+    for (bool withBulk : {false, true}) {
+        atomic<bool> running{true};
+        mutex resultsMutex;
+        vector<uint64_t> interactive, bulk;
+        uint64_t busy = 0;
+        vector<thread> threads;
+        // Interactive clients toggle preloaded tasks, which have IDs 1 to 20000.
+        for (size_t c = 0; c < 2; ++c) {
+            threads.emplace_back([&, c] {
+                runLoadClient(socketPath, running, [c](size_t i) {
+                    return (i % 2 == 0 ? "COMPLETE " : "PENDING ") + to_string(c * 1000 + i / 2 % 1000 + 1);
+                }, resultsMutex, interactive, busy);
+            });
+        }
+        if (withBulk) {
+            threads.emplace_back([&] {
+                runLoadClient(socketPath, running, [](size_t i) {
+                    string items;
+                    for (size_t item = 0; item < 2000; ++item) {
+                        items += (item > 0 ? "|" : "") + ("Imported " + to_string(i) + "-" + to_string(item));
+                    }
+                    return "IMPORT " + items;
+                }, resultsMutex, bulk, busy);
+            });
+        }
+        this_thread::sleep_for(chrono::seconds(1));
+        running = false;
+        for (thread& t : threads) {
+            t.join();
+        }
+        sort(interactive.begin(), interactive.end());
+        sort(bulk.begin(), bulk.end());
+        cout << (withBulk ? "interactive with bulk imports: p50_us " : "interactive alone: p50_us ") << percentile(interactive, 0.5)
+             << ", p99_us " << percentile(interactive, 0.99);
+        if (withBulk) {
+            cout << "; " << bulk.size() << " imports of 2000 tasks, p50_us " << percentile(bulk, 0.5);
+        }
+        cout << endl;
+    }
+    cout << server.metrics() << endl;
+}
+#endif
+
+Task promptForTask() {
+    string description, due_date;
+    cout << "Enter task description: ";
+    cin.ignore();
+    getline(cin, description);
+
+    string addDueDate;
+    cout << "Do you want to add a due date? (y/n): ";
+    cin >> addDueDate;
+
+    if (addDueDate == "y" || addDueDate == "Y") {
+        cout << "Enter due date (YYYY-MM-DD): ";
+        cin >> due_date;
+    }
+
+    string tagLine;
+    vector<string> tags;
+    cout << "Enter tags separated by commas (leave empty for none): ";
+    cin.ignore();
+    getline(cin, tagLine);
+    size_t start = 0;
+    while (start <= tagLine.size()) {
+        size_t comma = tagLine.find(',', start);
+        string tag = tagLine.substr(start, comma == string::npos ? string::npos : comma - start);
+        size_t first = tag.find_first_not_of(" \t");
+        if (first != string::npos) {
+            tags.push_back(tag.substr(first, tag.find_last_not_of(" \t") - first + 1));
+        }
+        if (comma == string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+
+    return Task::Builder(description).setDueDate(due_date).setTags(tags).build();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        size_t taskCount = argc > 2 ? strtoull(argv[2], nullptr, 10) : 100000;
+        if (taskCount == 0) {
+            cerr << "--bench needs a task count of at least 1." << endl;
+            return 1;
+        }
+        runBenchmarks(taskCount);
+        return 0;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    if (argc > 2 && strcmp(argv[1], "--serve") == 0) {
+        return runServer(argv[2], argc > 3 ? argv[3] : "todo", argc > 4 ? strtoull(argv[4], nullptr, 10) : 0);
+    }
+    if (argc > 1 && strcmp(argv[1], "--load-test") == 0) {
+        runLoadTest();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--client-bench") == 0) {
+        runClientBenchmark();
+        return 0;
+    }
+#endif
+
+    ToDoListManager manager;
+    if (!manager.load("todo")) {
+        cout << "Could not read the saved tasks in todo.tasks; exiting so they are not overwritten." << endl;
+        return 1;
+    }
+    if (manager.getTaskCount() > 0) {
+        cout << "Loaded saved tasks." << endl;
+    }
+    manager.startRetention(chrono::minutes(1));
+
+    while (true) {
+        cout << "What would you like to do?" << endl;
+        cout << "1. Add a new task" << endl;
+        cout << "2. Mark a task as completed" << endl;
+        cout << "3. Mark a task as pending" << endl;
+        cout << "4. Delete a task" << endl;
+        cout << "5. View all tasks" << endl;
+        cout << "6. View completed tasks" << endl;
+        cout << "7. View pending tasks" << endl;
+        cout << "8. Undo" << endl;
+        cout << "9. Redo" << endl;
+        cout << "10. Exit" << endl;
+        cout << "11. Search tasks" << endl;
+        cout << "12. Search tasks by pattern" << endl;
+        cout << "13. Fuzzy search tasks" << endl;
+        cout << "14. Duplicate detection" << endl;
+        cout << "15. Find near-duplicate tasks" << endl;
+        cout << "16. Show statistics" << endl;
+        cout << "17. Show analytics" << endl;
+        cout << "18. View tasks as of a date" << endl;
+        cout << "19. Undo several steps" << endl;
+        cout << "20. Redo several steps" << endl;
+        cout << "21. Set or return to an undo checkpoint" << endl;
+        cout << "22. Add a subtask" << endl;
+        cout << "23. View a task and its subtasks" << endl;
+        cout << "24. Attach a note or file to a task" << endl;
+        cout << "25. View a task's attachments" << endl;
+        cout << "26. Set retention policy for completed tasks" << endl;
+        cout << "27. Open the full-screen view" << endl;
+        cout << "28. Show slow operations" << endl;
+        cout << "29. Set the slow operation threshold" << endl;
+        cout << "30. Show memory use and set a budget" << endl;
+
+        int choice;
+        cin >> choice;
+
+        switch (choice) {
+            case 1: {
+                Task task = promptForTask();
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                if (manager.addTask(task)) {
+                    cout << "Task added successfully!" << endl;
+                } else if (manager.isOverMemoryBudget()) {
+                    cout << "Memory budget reached; task not added." << endl;
+                } else {
+                    cout << "Duplicate task rejected." << endl;
+                }
+                break;
+            }
+            case 2: {
+                int index;
+                cout << "Enter task index: ";
+                cin >> index;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.markTaskCompleted(index - 1);
+                cout << "Task marked as completed!" << endl;
+                break;
+            }
+            case 3: {
+                int index;
+                cout << "Enter task index: ";
+                cin >> index;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.markTaskPending(index - 1);
+                cout << "Task marked as pending!" << endl;
+                break;
+            }
+            case 4: {
+                int index;
+                cout << "Enter task index: ";
+                cin >> index;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.deleteTask(index - 1);
+                cout << "Task and its subtasks deleted successfully!" << endl;
+                break;
+            }
+            case 5: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.viewTasks("Show all");
+                break;
+            }
+            case 6: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.viewTasks("Show completed");
+                break;
+            }
+            case 7: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.viewTasks("Show pending");
                 break;
             }
             case 8: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
                 manager.undo();
                 break;
             }
             case 9: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
                 manager.redo();
                 break;
             }
             case 10: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                if (!manager.save()) {
+                    cout << "Could not save tasks." << endl;
+                }
                 cout << "Exiting..." << endl;
                 return 0;
             }
+            case 11: {
+                string query;
+                cout << "Enter search text: ";
+                cin.ignore();
+                getline(cin, query);
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.searchTasks(query);
+                break;
+            }
+            case 12: {
+                string pattern;
+                cout << "Enter regular expression: ";
+                cin.ignore();
+                getline(cin, pattern);
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.regexSearchTasks(pattern);
+                break;
+            }
+            case 13: {
+                string query;
+                cout << "Enter search words: ";
+                cin.ignore();
+                getline(cin, query);
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.fuzzySearchTasks(query);
+                break;
+            }
+            case 14: {
+                {
+                    unique_lock<mutex> commandLock = manager.lockForCommand();
+                    manager.showDedupeStats();
+                }
+                string enable;
+                cout << "Reject duplicate tasks? (y/n): ";
+                cin >> enable;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.setDedupeEnabled(enable == "y" || enable == "Y");
+                break;
+            }
+            case 15: {
+                size_t clusters;
+                {
+                    unique_lock<mutex> commandLock = manager.lockForCommand();
+                    clusters = manager.findNearDuplicates();
+                }
+                if (clusters == 0) {
+                    break;
+                }
+                long long cluster;
+                cout << "Merge a cluster into its first task? (cluster number, 0 for none): ";
+                cin >> cluster;
+                if (!cin || cluster < 0) {
+                    cin.clear();
+                    cout << "Invalid cluster number." << endl;
+                    break;
+                }
+                if (cluster > 0) {
+                    unique_lock<mutex> commandLock = manager.lockForCommand();
+                    manager.mergeNearDuplicates(static_cast<size_t>(cluster));
+                }
+                break;
+            }
+            case 16: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.showStats();
+                break;
+            }
+            case 17: {
+                string fromDate, toDate;
+                long long fromDay, toDay;
+                cout << "Enter start date (YYYY-MM-DD): ";
+                cin >> fromDate;
+                cout << "Enter end date (YYYY-MM-DD): ";
+                cin >> toDate;
+                if (!parseDate(fromDate, fromDay) || !parseDate(toDate, toDay) || toDay < fromDay) {
+                    cout << "Invalid date range." << endl;
+                    break;
+                }
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.showAnalytics(fromDay, toDay);
+                break;
+            }
+            case 18: {
+                string date;
+                long long day;
+                cout << "Enter date (YYYY-MM-DD): ";
+                cin >> date;
+                if (!parseDate(date, day)) {
+                    cout << "Invalid date." << endl;
+                    break;
+                }
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.viewTasksAsOf((day + 1) * 24 * 60 * 60 - 1);
+                break;
+            }
+            case 19:
+            case 20: {
+                long long steps;
+                cout << "Enter number of steps: ";
+                cin >> steps;
+                if (!cin || steps <= 0) {
+                    cin.clear();
+                    cout << "Enter a positive number of steps." << endl;
+                    break;
+                }
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                if (choice == 19) {
+                    manager.undo(static_cast<size_t>(steps));
+                } else {
+                    manager.redo(static_cast<size_t>(steps));
+                }
+                break;
+            }
+            case 21: {
+                string name, action;
+                cout << "Enter checkpoint name: ";
+                cin >> name;
+                cout << "Set it or undo back to it? (s/u): ";
+                cin >> action;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                if (action == "s" || action == "S") {
+                    manager.setHistoryCheckpoint(name);
+                    cout << "Checkpoint set." << endl;
+                } else {
+                    manager.undoToCheckpoint(name);
+                }
+                break;
+            }
+            case 22: {
+                int parent;
+                cout << "Enter parent task index: ";
+                cin >> parent;
+                Task task = promptForTask();
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                if (manager.addSubtask(parent - 1, task)) {
+                    cout << "Subtask added successfully!" << endl;
+                } else {
+                    cout << "Subtask not added." << endl;
+                }
+                break;
+            }
+            case 23: {
+                int index;
+                cout << "Enter task index: ";
+                cin >> index;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.viewSubtree(index - 1);
+                break;
+            }
+            case 24: {
+                int index;
+                string kind;
+                cout << "Enter task index: ";
+                cin >> index;
+                cout << "Attach a note or a file? (n/f): ";
+                cin >> kind;
+                cin.ignore();
+                bool attached;
+                if (kind == "f" || kind == "F") {
+                    string path;
+                    cout << "Enter file path: ";
+                    getline(cin, path);
+                    ifstream file(path, ios::binary);
+                    if (!file) {
+                        cout << "Could not open file." << endl;
+                        break;
+                    }
+                    unique_lock<mutex> commandLock = manager.lockForCommand();
+                    attached = manager.attachToTask(index - 1, file, filesystem::path(path).filename().string(), false);
+                } else {
+                    string line, note;
+                    cout << "Enter the note, ending with a line containing only a dot:" << endl;
+                    while (getline(cin, line) && line != ".") {
+                        note += (note.empty() ? "" : "\n") + line;
+                    }
+                    istringstream content(note);
+                    unique_lock<mutex> commandLock = manager.lockForCommand();
+                    attached = manager.attachToTask(index - 1, content, "note", true);
+                }
+                cout << (attached ? "Attached successfully!" : "Could not attach.") << endl;
+                break;
+            }
+            case 25: {
+                int index;
+                cout << "Enter task index: ";
+                cin >> index;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.viewAttachments(index - 1);
+                break;
+            }
+            case 26: {
+                long long days, keep;
+                cout << "Purge completed tasks older than how many days? (0 for no limit): ";
+                cin >> days;
+                cout << "Keep at most how many completed tasks? (0 for no limit): ";
+                cin >> keep;
+                if (!cin || days < 0 || keep < 0) {
+                    cin.clear();
+                    cout << "Invalid retention policy." << endl;
+                    break;
+                }
+                RetentionPolicy policy;
+                policy.maxCompletedAgeDays = days;
+                policy.maxCompletedKept = static_cast<size_t>(keep);
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.setRetentionPolicy(policy);
+                cout << "Retention policy set." << endl;
+                break;
+            }
+            case 27: {
+#if defined(__unix__) || defined(__APPLE__)
+                TerminalUi ui(manager);
+                if (!ui.run()) {
+                    cout << "The full-screen view needs a terminal." << endl;
+                }
+#else
+                cout << "The full-screen view is not available on this platform." << endl;
+#endif
+                break;
+            }
+            case 28: {
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.showSlowOperations();
+                break;
+            }
+            case 29: {
+                long long micros;
+                cout << "Enter threshold in microseconds: ";
+                cin >> micros;
+                unique_lock<mutex> commandLock = manager.lockForCommand();
+                manager.setSlowOperationThreshold(chrono::microseconds(micros));
+                cout << "Threshold set." << endl;
+                break;
+            }
+            case 30: {
+                {
+                    unique_lock<mutex> commandLock = manager.lockForCommand();
+                    manager.showMemory();
+                }
+                string bytes;
+                cout << "Enter a memory budget in bytes (0 for no limit, empty to keep): ";
+                cin.ignore();
+                getline(cin, bytes);
+                if (!bytes.empty()) {
+                    unique_lock<mutex> commandLock = manager.lockForCommand();
+                    manager.setMemoryBudget(strtoull(bytes.c_str(), nullptr, 10));
+                    manager.showMemory();
+                }
+                break;
+            }
             default: {
                 cout << "Invalid choice. Please try again." << endl;
                 break;